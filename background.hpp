@@ -0,0 +1,279 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <omp.h>
+#include <optional>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "jump.hpp"
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+
+static inline constexpr std::uint64_t backgroundChunkRounds {1 << 16};
+static inline constexpr double defaultPressureLimit {10};
+static inline constexpr double defaultPressureInterval {1};
+
+/*
+ * The share of time in percent that some runnable task waited for a CPU,
+ * from the 'total' stall microseconds in /proc/pressure/cpu between two
+ * calls. Empty if the kernel has no PSI.
+ */
+class CpuPressure {
+    std::optional<std::uint64_t> lastTotal;
+    std::chrono::steady_clock::time_point lastTime;
+
+    [[nodiscard]] static std::optional<std::uint64_t> readTotal() {
+        std::ifstream in {"/proc/pressure/cpu"};
+        for(std::string line; std::getline(in, line);) {
+            if(!line.starts_with("some "))
+                continue;
+            std::size_t total {line.find("total=")};
+            if(total != std::string::npos)
+                return std::stoull(line.substr(total + 6));
+        }
+        return std::nullopt;
+    }
+
+public:
+    CpuPressure() : lastTotal{readTotal()}, lastTime{std::chrono::steady_clock::now()} {}
+
+    [[nodiscard]] bool available() const noexcept {
+        return lastTotal.has_value();
+    }
+
+    [[nodiscard]] double sample() {
+        std::optional<std::uint64_t> total {readTotal()};
+        auto now {std::chrono::steady_clock::now()};
+        double seconds {std::chrono::duration<double>(now - lastTime).count()};
+        double percent {total && lastTotal && seconds > 0
+            ? static_cast<double>(*total - *lastTotal) / (seconds * 1e4) : 0};
+        lastTotal = total;
+        lastTime = now;
+        return percent;
+    }
+};
+
+/*
+ * Runs the calling thread at the lowest priority, SCHED_IDLE or a nice level,
+ * and restores its scheduling when destroyed.
+ */
+class BackgroundPriority {
+    int policy;
+    sched_param parameters {};
+    pid_t tid {static_cast<pid_t>(syscall(SYS_gettid))};
+    int previousNice;
+    bool applied {false};
+
+public:
+    BackgroundPriority(bool idle, int niceLevel) noexcept
+        : policy{sched_getscheduler(0)}, previousNice{getpriority(PRIO_PROCESS, static_cast<id_t>(tid))} {
+        sched_getparam(0, &parameters);
+        if(idle) {
+            sched_param idleParameters {};
+            applied = sched_setscheduler(0, SCHED_IDLE, &idleParameters) == 0;
+        } else {
+            applied = setpriority(PRIO_PROCESS, static_cast<id_t>(tid), niceLevel) == 0;
+        }
+    }
+
+    BackgroundPriority(const BackgroundPriority&) = delete;
+    BackgroundPriority& operator=(const BackgroundPriority&) = delete;
+
+    // Raising the priority again may need privileges; failing is harmless.
+    ~BackgroundPriority() {
+        sched_setscheduler(0, policy, &parameters);
+        setpriority(PRIO_PROCESS, static_cast<id_t>(tid), previousNice);
+    }
+
+    [[nodiscard]] bool ok() const noexcept {
+        return applied;
+    }
+};
+
+[[nodiscard]] inline double threadCpuSeconds() noexcept {
+    timespec time {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return static_cast<double>(time.tv_sec) + static_cast<double>(time.tv_nsec) * 1e-9;
+}
+
+struct BackgroundChunk {
+    State generator;
+    std::uint64_t roundCount;
+};
+
+struct BackgroundResult {
+    Int maxCount {0};
+    // CPU time the workers got.
+    double cpuSeconds {0};
+    double parkedSeconds {0};
+    double activeWorkerSeconds {0};
+    bool priorityFailed {false};
+};
+
+/*
+ * runSimulation's rounds at background priority. The thread streams of
+ * runSimulation are cut into chunks that any worker can pick up, starting
+ * from their jumped-to generator, so the maximum is the same however many
+ * workers are running. A controller samples the CPU pressure every
+ * 'interval' seconds: above 'limit' percent it parks a quarter of the running
+ * workers (at least one), below half of it it unparks one. Parked workers
+ * wait between chunks and cost nothing, and leave once all chunks are taken.
+ */
+[[nodiscard]] inline BackgroundResult runBackgroundSimulation(State seed,
+        std::uint64_t roundCount, bool idle, int niceLevel, double limit, double interval) {
+    std::uint64_t threads {static_cast<std::uint64_t>(omp_get_max_threads())};
+    std::vector<BackgroundChunk> chunks;
+    for(std::uint64_t t {0}; t < threads; ++t) {
+        WorkerRange range {workerRange(seed, roundCount, t, threads)};
+        for(std::uint64_t i {range.begin}; i < range.end; i += backgroundChunkRounds)
+            chunks.push_back({.generator = jumpAhead(range.state, 2 * (i - range.begin)),
+                .roundCount = std::min(backgroundChunkRounds, range.end - i)});
+    }
+
+    BackgroundResult result;
+    std::atomic<std::size_t> nextChunk {0};
+    std::atomic<std::uint64_t> active {threads};
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool done {false};
+
+    CpuPressure pressure;
+    std::thread controller;
+    if(pressure.available()) {
+        controller = std::thread {[&] {
+            Stopwatch stopwatch;
+            double last {0};
+            std::unique_lock lock {mutex};
+            while(!changed.wait_for(lock, std::chrono::duration<double>(interval),
+                    [&] { return done; })) {
+                std::uint64_t running {active.load(std::memory_order_relaxed)};
+                double now {stopwatch.seconds()};
+                result.activeWorkerSeconds += static_cast<double>(running) * (now - last);
+                last = now;
+
+                // Once every chunk is taken no worker has anything left to wait for.
+                if(nextChunk.load(std::memory_order_relaxed) >= chunks.size()) {
+                    active.store(threads, std::memory_order_relaxed);
+                    changed.notify_all();
+                    continue;
+                }
+                double percent {pressure.sample()};
+                if(percent > limit && running > 0)
+                    running -= std::max<std::uint64_t>(running / 4, 1);
+                else if(percent < limit / 2 && running < threads)
+                    ++running;
+                active.store(running, std::memory_order_relaxed);
+                changed.notify_all();
+            }
+            result.activeWorkerSeconds += static_cast<double>(active.load()) * (stopwatch.seconds() - last);
+        }};
+    }
+
+    # pragma omp parallel
+    {
+        BackgroundPriority priority {idle, niceLevel};
+        std::uint64_t thread {static_cast<std::uint64_t>(omp_get_thread_num())};
+        Int localMax {0};
+        double cpuStart {threadCpuSeconds()};
+        double parked {0};
+
+        while(true) {
+            if(thread >= active.load(std::memory_order_relaxed)) {
+                if(nextChunk.load(std::memory_order_relaxed) >= chunks.size())
+                    break;
+                Stopwatch waiting;
+                std::unique_lock lock {mutex};
+                changed.wait_for(lock, std::chrono::duration<double>(interval), [&] {
+                    return thread < active.load(std::memory_order_relaxed)
+                        || nextChunk.load(std::memory_order_relaxed) >= chunks.size();
+                });
+                parked += waiting.seconds();
+                continue;
+            }
+
+            std::size_t c {nextChunk.fetch_add(1, std::memory_order_relaxed)};
+            if(c >= chunks.size())
+                break;
+            State generator {chunks[c].generator};
+            for(std::uint64_t i {0}; i < chunks[c].roundCount; ++i)
+                localMax = std::max(localMax, calculateRound(deriveNewState(generator)));
+        }
+
+        # pragma omp critical
+        {
+            result.maxCount = std::max(result.maxCount, localMax);
+            result.cpuSeconds += threadCpuSeconds() - cpuStart;
+            result.parkedSeconds += parked;
+            result.priorityFailed |= !priority.ok();
+        }
+    }
+
+    if(controller.joinable()) {
+        {
+            std::lock_guard lock {mutex};
+            done = true;
+        }
+        changed.notify_all();
+        controller.join();
+    }
+
+    return result;
+}
+
+/*
+ * The plain simulation of 'rounds=' rounds as a background job: every worker
+ * runs under SCHED_IDLE ('priority=idle', the default) or at 'nice=' (with
+ * 'priority=nice'), and workers are parked while the CPU pressure is above
+ * 'pressure=' percent (default 10), checked every 'interval=' seconds.
+ */
+inline int runBackgroundMode(const Options& options, State seed) {
+    std::uint64_t roundCount {options.getUnsigned("rounds", rounds)};
+    std::string priority {options.getString("priority", "idle")};
+    int niceLevel {static_cast<int>(options.getUnsigned("nice", 19))};
+    double limit {options.getDouble("pressure", defaultPressureLimit)};
+    double interval {options.getDouble("interval", defaultPressureInterval)};
+    if(priority != "idle" && priority != "nice")
+        throw std::invalid_argument {"priority must be idle or nice"};
+    if(interval <= 0)
+        throw std::invalid_argument {"interval must be positive"};
+
+    if(!CpuPressure{}.available())
+        std::cerr << "No /proc/pressure/cpu, running all workers at background priority"
+            << std::endl;
+
+    Stopwatch stopwatch;
+    BackgroundResult result {runBackgroundSimulation(seed, roundCount, priority == "idle",
+            niceLevel, limit, interval)};
+    double seconds {stopwatch.seconds()};
+    if(result.priorityFailed)
+        std::cerr << "Could not lower the priority of every worker" << std::endl;
+
+    unsigned cpus {std::max(std::thread::hardware_concurrency(), 1u)};
+    std::cerr << "Ran " << roundCount << " rounds in " << seconds << " s, "
+        << static_cast<std::uint64_t>(roundCount / seconds) << " rounds/s" << std::endl;
+    std::cerr << "Harvested " << result.cpuSeconds << " CPU seconds, "
+        << 100 * result.cpuSeconds / (seconds * cpus) << "% of " << cpus
+        << " CPUs; workers were parked for " << result.parkedSeconds << " s";
+    if(result.activeWorkerSeconds > 0)
+        std::cerr << ", " << result.activeWorkerSeconds / seconds
+            << " workers running on average";
+    std::cerr << std::endl;
+    std::cerr << "Found at max " << result.maxCount << " hits" << std::endl;
+    return 0;
+}
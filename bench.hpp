@@ -0,0 +1,295 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <omp.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "frequency.hpp"
+#include "lanes.hpp"
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+#include "swar.hpp"
+
+static inline constexpr std::uint64_t defaultBenchRounds {2'000'000};
+static inline constexpr std::uint64_t defaultRepetitions {10};
+static inline constexpr double defaultAlpha {0.01};
+static inline constexpr double defaultTolerance {0.02};
+
+/*
+ * A benchmarked kernel: 'measure' runs it on 'rounds' rounds and returns
+ * rounds per second. Regressions of gating kernels fail the comparison.
+ */
+struct BenchKernel {
+    const char* name;
+    bool gating;
+    bool parallel;
+    double (*measure)(State seed, std::uint64_t rounds);
+};
+
+static inline constexpr BenchKernel benchKernels[] {
+    {"calculateRound", true, false, [](State seed, std::uint64_t roundCount) {
+        Stopwatch stopwatch;
+        Int maxCount {0};
+        for(std::uint64_t i {0}; i < roundCount; ++i)
+            maxCount = std::max(maxCount, calculateRound(deriveNewState(seed)));
+        double seconds {stopwatch.seconds()};
+        // Keeps the loop from being optimised away.
+        if(maxCount > attempts)
+            std::cerr << maxCount << std::endl;
+        return roundCount / seconds;
+    }},
+    {"runSimulation", true, true, [](State seed, std::uint64_t roundCount) {
+        Stopwatch stopwatch;
+        Int maxCount {runSimulation(seed, roundCount, calculateRound)};
+        double seconds {stopwatch.seconds()};
+        if(maxCount > attempts)
+            std::cerr << maxCount << std::endl;
+        return roundCount / seconds;
+    }},
+    {"roundLanes", false, true, [](State seed, std::uint64_t roundCount) {
+        Stopwatch stopwatch;
+        Int maxCount {runRoundLanes(seed, roundCount)};
+        double seconds {stopwatch.seconds()};
+        if(maxCount > attempts)
+            std::cerr << maxCount << std::endl;
+        return roundCount / seconds;
+    }},
+    {"roundSwar", false, true, [](State seed, std::uint64_t roundCount) {
+        Stopwatch stopwatch;
+        Int maxCount {runRoundSwar(seed, roundCount)};
+        double seconds {stopwatch.seconds()};
+        if(maxCount > attempts)
+            std::cerr << maxCount << std::endl;
+        return roundCount / seconds;
+    }},
+};
+
+/*
+ * What the numbers depend on besides the code: the CPU, the number of
+ * threads, the compiler and the instruction sets compiled for.
+ */
+[[nodiscard]] inline std::string hostDescription() {
+    std::string cpu {"unknown"};
+    std::ifstream cpuinfo {"/proc/cpuinfo"};
+    for(std::string line; std::getline(cpuinfo, line);) {
+        if(line.starts_with("model name") || line.starts_with("Model")) {
+            cpu = line.substr(line.find(':') + 2);
+            break;
+        }
+    }
+
+    std::ostringstream description;
+    description << cpu << "; " << omp_get_max_threads() << " threads; gcc " << __VERSION__;
+#if defined(__AVX512F__)
+    description << "; avx512";
+#elif defined(__AVX2__)
+    description << "; avx2";
+#endif
+    return description.str();
+}
+
+// FNV-1a, enough to name a file after the host description.
+[[nodiscard]] inline std::string fingerprint(const std::string& description) {
+    std::uint64_t hash {0xcbf29ce484222325};
+    for(unsigned char c : description)
+        hash = (hash ^ c) * 0x100000001b3;
+    std::ostringstream out;
+    out << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return out.str();
+}
+
+[[nodiscard]] inline double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    std::size_t n {values.size()};
+    return n % 2 == 1 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+/*
+ * The two-sided p-value of the Mann-Whitney U test of two samples, from the
+ * normal approximation with tie and continuity corrections, which is fair from
+ * about eight values per sample on.
+ */
+[[nodiscard]] inline double mannWhitney(const std::vector<double>& a,
+        const std::vector<double>& b) {
+    struct Value {
+        double value;
+        bool first;
+    };
+    std::vector<Value> all;
+    for(double x : a)
+        all.push_back({x, true});
+    for(double x : b)
+        all.push_back({x, false});
+    std::sort(all.begin(), all.end(), [](Value x, Value y) { return x.value < y.value; });
+
+    double n1 {static_cast<double>(a.size())};
+    double n2 {static_cast<double>(b.size())};
+    double n {n1 + n2};
+    double rankSum {0};
+    double ties {0};
+    for(std::size_t i {0}; i < all.size();) {
+        std::size_t j {i};
+        while(j < all.size() && all[j].value == all[i].value)
+            ++j;
+        double rank {(i + 1 + j) / 2.0};
+        for(std::size_t k {i}; k < j; ++k)
+            rankSum += all[k].first ? rank : 0;
+        double t {static_cast<double>(j - i)};
+        ties += t * t * t - t;
+        i = j;
+    }
+
+    double u {rankSum - n1 * (n1 + 1) / 2};
+    double mean {n1 * n2 / 2};
+    double variance {n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1)))};
+    if(variance <= 0)
+        return 1;
+    double z {(std::abs(u - mean) - 0.5) / std::sqrt(variance)};
+    return std::min(1.0, std::erfc(std::max(z, 0.0) / std::sqrt(2.0)));
+}
+
+using BenchResults = std::map<std::string, std::vector<double>>;
+
+/*
+ * A baseline file: the host description, then a line per kernel with its
+ * name and the rounds per second of every repetition.
+ */
+inline void writeBaseline(const std::filesystem::path& path, const std::string& description,
+        const BenchResults& results) {
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream out {path, std::ios::trunc};
+    out << std::setprecision(10) << "host " << description << "\n";
+    for(const auto& [name, values] : results) {
+        out << name;
+        for(double value : values)
+            out << " " << value;
+        out << "\n";
+    }
+    if(!out)
+        throw std::runtime_error {"Could not write " + path.string()};
+}
+
+[[nodiscard]] inline BenchResults readBaseline(const std::filesystem::path& path) {
+    BenchResults results;
+    std::ifstream in {path};
+    for(std::string line; std::getline(in, line);) {
+        if(line.starts_with("host "))
+            continue;
+        std::istringstream fields {line};
+        std::string name;
+        fields >> name;
+        for(double value; fields >> value;)
+            results[name].push_back(value);
+    }
+    return results;
+}
+
+/*
+ * Benchmarks every kernel 'repeat=' times on 'rounds=' rounds. With 'save=1'
+ * the results become the baseline of this host in 'baseline=' (a directory,
+ * one file per host fingerprint). Otherwise they are compared with the
+ * baseline, if there is one: a kernel has regressed if the Mann-Whitney test
+ * finds a difference at level 'alpha=' and the median is more than
+ * 'tolerance=' slower. Regressions of calculateRound or runSimulation make
+ * the mode fail.
+ */
+inline int runBenchMode(const Options& options, State seed) {
+    std::uint64_t roundCount {options.getUnsigned("rounds", defaultBenchRounds)};
+    std::uint64_t repeat {std::max<std::uint64_t>(options.getUnsigned("repeat", defaultRepetitions), 1)};
+    std::filesystem::path directory {options.getString("baseline", "baselines")};
+    bool save {options.getUnsigned("save", 0) != 0};
+    double alpha {options.getDouble("alpha", defaultAlpha)};
+    double tolerance {options.getDouble("tolerance", defaultTolerance)};
+
+    std::string description {hostDescription()};
+    std::filesystem::path path {directory / (fingerprint(description) + ".txt")};
+    std::cerr << "Host " << fingerprint(description) << ": " << description << std::endl;
+
+    // The kernels take turns, so a slow phase of the host hits all of them.
+    BenchResults results;
+    EnvironmentMonitor monitor;
+    std::map<std::string, EnvironmentTotals> environment;
+    for(const BenchKernel& kernel : benchKernels)
+        static_cast<void>(kernel.measure(seed, roundCount));
+    for(std::uint64_t r {0}; r < repeat; ++r) {
+        for(const BenchKernel& kernel : benchKernels) {
+            monitor.restartExtremes();
+            EnvironmentTotals before {monitor.snapshot()};
+            results[kernel.name].push_back(kernel.measure(seed, roundCount));
+            environment[kernel.name].add(before, monitor.snapshot());
+        }
+    }
+
+    // The clock, cycles per round and throttling while a kernel ran.
+    auto printEnvironment = [&](const BenchKernel& kernel) {
+        EnvironmentReport report {monitor.report({}, environment[kernel.name])};
+        if(!report.hasFrequency && !report.hasTemperature && !report.hasThrottling)
+            return;
+        std::cerr << "  ";
+        report.print(std::cerr);
+        if(report.hasFrequency)
+            std::cerr << ", " << static_cast<std::uint64_t>(report.cyclesPerRound(
+                    median(results[kernel.name]),
+                    kernel.parallel ? static_cast<unsigned>(omp_get_max_threads()) : 1))
+                << " cycles/round";
+        std::cerr << std::endl;
+    };
+
+    if(save) {
+        writeBaseline(path, description, results);
+        for(const BenchKernel& kernel : benchKernels) {
+            std::cerr << kernel.name << ": "
+                << static_cast<std::uint64_t>(median(results[kernel.name]))
+                << " rounds/s" << std::endl;
+            printEnvironment(kernel);
+        }
+        std::cerr << "Saved the baseline to " << path.string() << std::endl;
+        return 0;
+    }
+
+    BenchResults baseline;
+    if(std::filesystem::exists(path))
+        baseline = readBaseline(path);
+    else
+        std::cerr << "No baseline for this host in " << directory.string()
+            << ", run with save=1 to create one" << std::endl;
+
+    bool regressed {false};
+    for(const BenchKernel& kernel : benchKernels) {
+        const std::vector<double>& now {results[kernel.name]};
+        std::cerr << std::left << std::setw(16) << kernel.name << std::right
+            << std::setw(12) << static_cast<std::uint64_t>(median(now)) << " rounds/s";
+
+        auto before {baseline.find(kernel.name)};
+        if(before == baseline.end() || before->second.empty()) {
+            std::cerr << std::endl;
+            printEnvironment(kernel);
+            continue;
+        }
+
+        double delta {median(now) / median(before->second) - 1};
+        double p {mannWhitney(now, before->second)};
+        bool slower {p < alpha && delta < -tolerance};
+        std::cerr << ", baseline " << static_cast<std::uint64_t>(median(before->second))
+            << ", " << std::showpos << std::fixed << std::setprecision(1) << 100 * delta
+            << "%" << std::noshowpos << std::defaultfloat << std::setprecision(6)
+            << ", p = " << p
+            << (slower ? " REGRESSION" : p < alpha && delta > tolerance ? " faster" : "")
+            << std::endl;
+        printEnvironment(kernel);
+        regressed |= slower && kernel.gating;
+    }
+
+    return regressed ? 1 : 0;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "rng.hpp"
+
+static inline constexpr long double hitChance {0.25L};
+
+/*
+ * The distribution of the hits of a round if every attempt were an independent
+ * 1/4 chance. Upper tails are summed from the top so that tiny tail
+ * probabilities keep their precision instead of being lost in 1 - F(k).
+ */
+class Binomial {
+    Int trials;
+    std::vector<long double> pmf;
+    // upper[k] = P(X >= k), upper[trials + 1] = 0
+    std::vector<long double> upper;
+
+public:
+    explicit Binomial(Int n = attempts, long double p = hitChance)
+            : trials{n}, pmf(n + 1), upper(n + 2) {
+        for(Int k = 0; k <= n; ++k)
+            pmf[k] = std::exp(std::lgamma(n + 1.0L) - std::lgamma(k + 1.0L)
+                    - std::lgamma(n - k + 1.0L) + k * std::log(p)
+                    + (n - k) * std::log1p(-p));
+
+        upper[n + 1] = 0;
+        for(Int k = n + 1; k-- > 0;)
+            upper[k] = upper[k + 1] + pmf[k];
+    }
+
+    [[nodiscard]] Int n() const noexcept {
+        return trials;
+    }
+
+    [[nodiscard]] long double probability(Int k) const noexcept {
+        return k <= trials ? pmf[k] : 0;
+    }
+
+    // P(X >= k)
+    [[nodiscard]] long double atLeast(Int k) const noexcept {
+        // Rounding can push the sum of all probabilities slightly above 1.
+        return k <= trials ? std::min(upper[k], 1.0L) : 0;
+    }
+
+    // P(X <= k)
+    [[nodiscard]] long double atMost(Int k) const noexcept {
+        return 1 - atLeast(k + 1);
+    }
+
+    /*
+     * P(max of 'rounds' independent rounds <= k) = P(X <= k)^rounds, evaluated
+     * in log space.
+     */
+    [[nodiscard]] long double maxAtMost(Int k, long double rounds) const noexcept {
+        return std::exp(rounds * std::log1p(-atLeast(k + 1)));
+    }
+
+    // P(max of 'rounds' independent rounds >= k), accurate when tiny.
+    [[nodiscard]] long double maxAtLeast(Int k, long double rounds) const noexcept {
+        if(k == 0)
+            return 1;
+        return -std::expm1(rounds * std::log1p(-atLeast(k)));
+    }
+
+    [[nodiscard]] long double expectedMax(long double rounds) const noexcept {
+        long double sum {0};
+        for(Int k = 1; k <= trials; ++k)
+            sum += maxAtLeast(k, rounds);
+        return sum;
+    }
+
+    // The smallest k with P(max <= k) >= q.
+    [[nodiscard]] Int maxQuantile(long double q, long double rounds) const noexcept {
+        for(Int k = 0; k < trials; ++k)
+            if(maxAtMost(k, rounds) >= q)
+                return k;
+        return trials;
+    }
+};
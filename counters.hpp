@@ -0,0 +1,302 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <omp.h>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+#include "verifier.hpp"
+
+// Rounds a worker runs between publishing its counters.
+static inline constexpr std::uint64_t counterChunkRounds {1 << 16};
+
+/*
+ * What a worker has done so far. Only the worker writes it, once per chunk,
+ * and readers load it whenever they like; relaxed atomics are enough since
+ * every value is meaningful on its own. A cache line per worker keeps the
+ * workers from sharing lines.
+ */
+struct alignas(64) WorkerCounters {
+    std::atomic<std::uint64_t> rounds {0};
+    std::atomic<Int> maxCount {0};
+    std::array<std::atomic<std::uint64_t>, attempts + 1> histogram {};
+};
+
+struct CounterSnapshot {
+    double seconds {0};
+    std::vector<std::uint64_t> rounds;
+    Int maxCount {0};
+    Histogram histogram {};
+
+    [[nodiscard]] std::uint64_t totalRounds() const noexcept {
+        std::uint64_t total {0};
+        for(std::uint64_t r : rounds)
+            total += r;
+        return total;
+    }
+};
+
+class RunCounters {
+    std::size_t workerCount;
+    std::unique_ptr<WorkerCounters[]> workers;
+    Stopwatch stopwatch;
+
+public:
+    explicit RunCounters(std::size_t count = static_cast<std::size_t>(omp_get_max_threads()))
+        : workerCount{count}, workers{std::make_unique<WorkerCounters[]>(count)} {}
+
+    [[nodiscard]] WorkerCounters& operator[](std::size_t worker) noexcept {
+        return workers[worker];
+    }
+
+    [[nodiscard]] CounterSnapshot snapshot() const {
+        CounterSnapshot snapshot {.seconds = stopwatch.seconds(), .rounds = {},
+            .maxCount = 0, .histogram = {}};
+        for(std::size_t w {0}; w < workerCount; ++w) {
+            const WorkerCounters& worker {workers[w]};
+            snapshot.rounds.push_back(worker.rounds.load(std::memory_order_relaxed));
+            snapshot.maxCount = std::max(snapshot.maxCount,
+                    worker.maxCount.load(std::memory_order_relaxed));
+            for(Int k = 0; k <= attempts; ++k)
+                snapshot.histogram[k] += worker.histogram[k].load(std::memory_order_relaxed);
+        }
+        return snapshot;
+    }
+};
+
+/*
+ * Set by SIGINT and SIGTERM while a StopSignals object lives; workers look at
+ * it once per chunk. Holds the signal number.
+ */
+inline std::atomic<int> stopSignal {0};
+static_assert(std::atomic<int>::is_always_lock_free);
+
+/*
+ * Turns SIGINT and SIGTERM into a request to stop. Each handler is reset to
+ * the default after firing once, so a second Ctrl-C still kills the process.
+ */
+class StopSignals {
+    struct sigaction previousInt {};
+    struct sigaction previousTerm {};
+
+public:
+    StopSignals() noexcept {
+        struct sigaction action {};
+        action.sa_handler = [](int signal) {
+            stopSignal.store(signal, std::memory_order_relaxed);
+        };
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESETHAND;
+        sigaction(SIGINT, &action, &previousInt);
+        sigaction(SIGTERM, &action, &previousTerm);
+    }
+
+    StopSignals(const StopSignals&) = delete;
+    StopSignals& operator=(const StopSignals&) = delete;
+
+    ~StopSignals() {
+        sigaction(SIGINT, &previousInt, nullptr);
+        sigaction(SIGTERM, &previousTerm, nullptr);
+    }
+};
+
+// Keep the highest rounds of every run.
+static inline constexpr std::size_t defaultTopRounds {10};
+
+/*
+ * Round 'round' is the round runSimulation evaluates at loop index 'round'.
+ */
+struct TopRound {
+    std::uint64_t round;
+    Int count;
+};
+
+struct RoundRange {
+    std::uint64_t begin;
+    std::uint64_t end;
+};
+
+/*
+ * What a run found in the rounds it completed: all of them, or those of
+ * 'completed' if it was stopped.
+ */
+struct RunResult {
+    std::uint64_t roundCount {0};
+    Int maxCount {0};
+    Histogram histogram {};
+    std::vector<TopRound> top {};
+    std::vector<RoundRange> completed {};
+    int signal {0};
+
+    [[nodiscard]] std::uint64_t completedRounds() const noexcept {
+        std::uint64_t total {0};
+        for(RoundRange range : completed)
+            total += range.end - range.begin;
+        return total;
+    }
+};
+
+/*
+ * runSimulation with the same rounds, publishing every worker's progress,
+ * maximum and histogram to 'counters' once per chunk. Once stopSignal is set,
+ * every worker finishes its chunk and the result covers what was done. A
+ * 'verifier' checks a sample of the rounds against calculateRound; after a
+ * mismatch the workers stop the same way.
+ */
+template<typename Kernel>
+[[nodiscard]] RunResult runCountedSimulation(State state, std::uint64_t roundCount,
+        const Kernel& kernel, RunCounters& counters,
+        std::size_t topRounds = defaultTopRounds, RoundVerifier* verifier = nullptr) {
+    RunResult result;
+    result.roundCount = roundCount;
+    auto higher = [](const TopRound& a, const TopRound& b) { return a.count > b.count; };
+
+    forEachWorker(state, roundCount,
+            [&](State& generator, std::uint64_t begin, std::uint64_t end) {
+        WorkerCounters& published {counters[static_cast<std::size_t>(omp_get_thread_num())]};
+        Histogram histogram {};
+        Int localMax {0};
+        // A min-heap of the highest rounds, and the count a round must beat.
+        std::vector<TopRound> top;
+        Int topThreshold {0};
+        std::uint64_t done {begin};
+        while(done < end && stopSignal.load(std::memory_order_relaxed) == 0
+                && (verifier == nullptr || !verifier->failed())) {
+            std::uint64_t chunkEnd {std::min(end, done + counterChunkRounds)};
+            for(std::uint64_t i {done}; i < chunkEnd; ++i) {
+                State round {deriveNewState(generator)};
+                Int count {kernel(round)};
+                if(verifier != nullptr)
+                    verifier->verify(round, count);
+                ++histogram[count];
+                localMax = std::max(localMax, count);
+                if(count >= topThreshold && topRounds != 0) {
+                    top.push_back({.round = i, .count = count});
+                    std::push_heap(top.begin(), top.end(), higher);
+                    if(top.size() > topRounds) {
+                        std::pop_heap(top.begin(), top.end(), higher);
+                        top.pop_back();
+                    }
+                    if(top.size() == topRounds)
+                        topThreshold = top.front().count + 1;
+                }
+            }
+            done = chunkEnd;
+
+            for(Int k = 0; k <= attempts; ++k)
+                if(histogram[k] != 0)
+                    published.histogram[k].store(histogram[k], std::memory_order_relaxed);
+            published.maxCount.store(localMax, std::memory_order_relaxed);
+            published.rounds.store(done - begin, std::memory_order_relaxed);
+        }
+
+        # pragma omp critical
+        {
+            result.maxCount = std::max(result.maxCount, localMax);
+            for(Int k = 0; k <= attempts; ++k)
+                result.histogram[k] += histogram[k];
+            result.top.insert(result.top.end(), top.begin(), top.end());
+            if(done != begin)
+                result.completed.push_back({.begin = begin, .end = done});
+        }
+    });
+
+    std::sort(result.top.begin(), result.top.end(), [](const TopRound& a, const TopRound& b) {
+        return a.count != b.count ? a.count > b.count : a.round < b.round;
+    });
+    if(result.top.size() > topRounds)
+        result.top.resize(topRounds);
+
+    // Neighbouring threads' ranges join up when both finished.
+    std::sort(result.completed.begin(), result.completed.end(),
+            [](RoundRange a, RoundRange b) { return a.begin < b.begin; });
+    std::vector<RoundRange> merged;
+    for(RoundRange range : result.completed) {
+        if(!merged.empty() && merged.back().end == range.begin)
+            merged.back().end = range.end;
+        else
+            merged.push_back(range);
+    }
+    result.completed = std::move(merged);
+    result.signal = stopSignal.load(std::memory_order_relaxed);
+    return result;
+}
+
+/*
+ * The whole result as text: the seed, the completed ranges of rounds, the
+ * maximum, the highest rounds and the histogram.
+ */
+inline void writeRunResult(std::ostream& out, State seed, const RunResult& result) {
+    out << "seed " << seed.u << " " << seed.v << "\n"
+        << "rounds " << result.roundCount << "\n"
+        << "threads " << omp_get_max_threads() << "\n";
+    for(RoundRange range : result.completed)
+        out << "completed " << range.begin << " " << range.end << "\n";
+    out << "max " << result.maxCount << "\n";
+    for(TopRound round : result.top)
+        out << "top " << round.round << " " << round.count << "\n";
+    for(Int k = 0; k <= attempts; ++k)
+        if(result.histogram[k] != 0)
+            out << "histogram " << k << " " << result.histogram[k] << "\n";
+}
+
+/*
+ * Writes the result to 'path' aside and renames it into place, so an earlier
+ * result is only replaced by a complete one.
+ */
+inline bool writeRunResultFile(const std::string& path, State seed, const RunResult& result) {
+    std::string temporary {path + ".tmp"};
+    {
+        std::ofstream out {temporary, std::ios::trunc};
+        writeRunResult(out, seed, result);
+        if(!out)
+            return false;
+    }
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+/*
+ * Reports a run like the plain simulation does. A stopped run prints what it
+ * completed instead, with the histogram of its rounds, and exits with 128 +
+ * the signal, as the shell would. With 'checkpoint=' the result is also
+ * written to that file either way.
+ */
+inline int finishRun(const Options& options, State seed, const RunResult& result) {
+    std::string checkpoint {options.getString("checkpoint", "")};
+    if(!checkpoint.empty() && !writeRunResultFile(checkpoint, seed, result))
+        std::cerr << "Could not write " << checkpoint << std::endl;
+
+    if(result.signal == 0) {
+        std::cerr << "Found at max " << result.maxCount << " hits" << std::endl;
+        return 0;
+    }
+
+    std::cerr << "Stopped by signal " << result.signal << " after "
+        << result.completedRounds() << " of " << result.roundCount << " rounds"
+        << std::endl;
+    for(RoundRange range : result.completed)
+        std::cerr << "  completed rounds " << range.begin << " to " << range.end
+            << std::endl;
+    for(TopRound round : result.top)
+        std::cerr << "  round " << round.round << ": " << round.count << " hits"
+            << std::endl;
+    for(Int k = 0; k <= attempts; ++k)
+        if(result.histogram[k] != 0)
+            std::cerr << "  " << result.histogram[k] << " rounds with " << k << " hits"
+                << std::endl;
+    std::cerr << "Found at max " << result.maxCount << " hits in the completed rounds"
+        << std::endl;
+    return 128 + result.signal;
+}
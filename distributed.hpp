@@ -0,0 +1,366 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <system_error>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+#include "external.hpp"
+#include "ideal.hpp"
+#include "jump.hpp"
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+#include "xoshiro.hpp"
+
+static inline constexpr std::uint64_t defaultWorkers {4};
+static inline constexpr std::size_t verifiedTopRounds {8};
+static inline constexpr double defaultSampleFraction {0.001};
+static inline constexpr std::uint64_t minSamples {16};
+
+/*
+ * A range of rounds handed to a worker process: 'roundCount' rounds derived
+ * one after another from 'state', like one thread of runSimulation. The
+ * worker also reports the counts of 'samples' rounds drawn from
+ * Xoshiro256(sampleSeed), which the coordinator draws again to check them.
+ */
+struct Assignment {
+    std::uint64_t range;
+    State state;
+    std::uint64_t roundCount;
+    std::uint64_t sampleSeed;
+    std::uint64_t samples;
+};
+
+struct RoundHit {
+    std::uint64_t round;
+    Int count;
+};
+
+struct ReportHeader {
+    std::uint64_t range;
+    Int maxCount;
+    std::uint64_t top;
+};
+
+struct WorkerReport {
+    ReportHeader header;
+    std::vector<RoundHit> top;
+    std::vector<RoundHit> samples;
+};
+
+/*
+ * The state round 'round' of a range is derived from, without running the
+ * rounds before it.
+ */
+[[nodiscard]] inline State roundState(State rangeState, std::uint64_t round) noexcept {
+    State generator {jumpAhead(rangeState, 2 * round)};
+    return deriveNewState(generator);
+}
+
+[[nodiscard]] inline std::vector<std::uint64_t> sampleRounds(const Assignment& assignment) {
+    Xoshiro256 generator {assignment.sampleSeed};
+    std::vector<std::uint64_t> rounds(assignment.samples);
+    for(std::uint64_t& round : rounds)
+        round = generator() % assignment.roundCount;
+    return rounds;
+}
+
+// Sends without SIGPIPE: a peer that is gone shows up as EPIPE instead.
+inline void writeAll(int fd, const void* data, std::size_t size) {
+    const char* bytes {static_cast<const char*>(data)};
+    while(size != 0) {
+        ssize_t n {send(fd, bytes, size, MSG_NOSIGNAL)};
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            throwSystemError("send");
+        bytes += n;
+        size -= static_cast<std::size_t>(n);
+    }
+}
+
+// False at the end of the stream before the first byte.
+inline bool readAll(int fd, void* data, std::size_t size) {
+    char* bytes {static_cast<char*>(data)};
+    std::size_t done {0};
+    while(done != size) {
+        ssize_t n {read(fd, bytes + done, size - done)};
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            throwSystemError("read");
+        if(n == 0) {
+            if(done == 0)
+                return false;
+            throw std::runtime_error {"Truncated message"};
+        }
+        done += static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+template<typename T>
+void writeValues(int fd, const std::vector<T>& values) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    writeAll(fd, values.data(), values.size() * sizeof(T));
+}
+
+/*
+ * Runs the rounds of an assignment and keeps the 'verifiedTopRounds' highest
+ * ones and the counts of the sampled rounds. 'faulty' stands in for a
+ * misconfigured worker that scores all 16 pairs of the last output.
+ */
+[[nodiscard]] inline WorkerReport runAssignment(const Assignment& assignment, bool faulty) {
+    std::vector<std::uint64_t> samples {sampleRounds(assignment)};
+    std::vector<std::uint64_t> order(samples);
+    std::sort(order.begin(), order.end());
+
+    WorkerReport report {.header = {.range = assignment.range, .maxCount = 0, .top = 0},
+        .top = {}, .samples = {}};
+    std::vector<RoundHit> sampled;
+    auto lower = [](const RoundHit& a, const RoundHit& b) { return a.count > b.count; };
+
+    State generator {assignment.state};
+    auto next {order.begin()};
+    for(std::uint64_t i {0}; i < assignment.roundCount; ++i) {
+        State state {deriveNewState(generator)};
+        Int count {calculateRound(state)};
+        if(faulty) {
+            count = 0;
+            for(Int j {0}; j <= completeAttempts; ++j)
+                count += countPairwiseZeroBits(nextRandomNumber(state));
+        }
+
+        report.header.maxCount = std::max(report.header.maxCount, count);
+        if(report.top.size() < verifiedTopRounds || count > report.top.front().count) {
+            if(report.top.size() == verifiedTopRounds) {
+                std::pop_heap(report.top.begin(), report.top.end(), lower);
+                report.top.pop_back();
+            }
+            report.top.push_back({.round = i, .count = count});
+            std::push_heap(report.top.begin(), report.top.end(), lower);
+        }
+        for(; next != order.end() && *next == i; ++next)
+            sampled.push_back({.round = i, .count = count});
+    }
+
+    // Reported in the order the coordinator drew the samples.
+    for(std::uint64_t round : samples)
+        report.samples.push_back(*std::lower_bound(sampled.begin(), sampled.end(), round,
+                [](const RoundHit& hit, std::uint64_t r) { return hit.round < r; }));
+    report.header.top = report.top.size();
+    return report;
+}
+
+/*
+ * The loop of a worker process: assignments in, reports out, until the
+ * coordinator closes the connection.
+ */
+inline void runWorker(int fd, bool faulty) {
+    Assignment assignment;
+    while(readAll(fd, &assignment, sizeof(assignment))) {
+        WorkerReport report {runAssignment(assignment, faulty)};
+        writeAll(fd, &report.header, sizeof(report.header));
+        writeValues(fd, report.top);
+        writeValues(fd, report.samples);
+    }
+}
+
+/*
+ * Re-evaluates every sampled and every top round of a report with
+ * calculateRound. Returns an empty string if they all agree, the reason
+ * otherwise.
+ */
+[[nodiscard]] inline std::string verifyReport(const Assignment& assignment,
+        const WorkerReport& report, std::uint64_t& verifiedRounds) {
+    std::vector<std::uint64_t> samples {sampleRounds(assignment)};
+    auto check = [&](const RoundHit& hit) {
+        ++verifiedRounds;
+        return hit.round < assignment.roundCount
+            && calculateRound(roundState(assignment.state, hit.round)) == hit.count;
+    };
+
+    for(std::size_t i {0}; i < samples.size(); ++i) {
+        if(report.samples[i].round != samples[i] || !check(report.samples[i]))
+            return "sampled round " + std::to_string(samples[i]) + " differs";
+        if(report.samples[i].count > report.header.maxCount)
+            return "sampled round " + std::to_string(samples[i]) + " exceeds the maximum";
+    }
+
+    Int topMax {0};
+    for(const RoundHit& hit : report.top) {
+        if(!check(hit))
+            return "top round " + std::to_string(hit.round) + " differs";
+        topMax = std::max(topMax, hit.count);
+    }
+    if(topMax != report.header.maxCount)
+        return "maximum " + std::to_string(report.header.maxCount)
+            + " is not its top round";
+    return {};
+}
+
+struct WorkerProcess {
+    pid_t pid;
+    int fd;
+    bool busy {false};
+    bool trusted {true};
+    Assignment assignment {};
+};
+
+/*
+ * Splits 'rounds=' rounds into 'ranges=' ranges (default 4 per worker) laid
+ * out like the threads of runSimulation, runs them on 'workers=' forked
+ * worker processes and verifies every report: a 'sample=' fraction of each
+ * range's rounds (at least 16) and its 8 highest rounds are recomputed. A
+ * range whose report disagrees goes to another worker, and the worker gets no
+ * more work. 'faulty=w' makes worker w miscount on purpose. The result equals
+ * runSimulation on 'ranges' threads.
+ */
+inline int runDistributedMode(const Options& options, State seed) {
+    std::uint64_t roundCount {options.getUnsigned("rounds", rounds)};
+    std::uint64_t workerCount {std::max<std::uint64_t>(options.getUnsigned("workers", defaultWorkers), 1)};
+    std::uint64_t rangeCount {std::max<std::uint64_t>(options.getUnsigned("ranges", 4 * workerCount), 1)};
+    double sampleFraction {options.getDouble("sample", defaultSampleFraction)};
+    std::uint64_t faulty {options.getUnsigned("faulty", workerCount)};
+
+    // Forked before this process starts any OpenMP threads.
+    std::vector<WorkerProcess> workers;
+    for(std::uint64_t w {0}; w < workerCount; ++w) {
+        int fds[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+            throwSystemError("socketpair");
+        pid_t pid {fork()};
+        if(pid < 0)
+            throwSystemError("fork");
+        if(pid == 0) {
+            close(fds[0]);
+            for(const WorkerProcess& other : workers)
+                close(other.fd);
+            try {
+                runWorker(fds[1], w == faulty);
+            } catch(const std::exception& e) {
+                std::cerr << "Worker " << w << ": " << e.what() << std::endl;
+                _exit(1);
+            }
+            _exit(0);
+        }
+        close(fds[1]);
+        workers.push_back({.pid = pid, .fd = fds[0]});
+    }
+
+    std::deque<Assignment> pending;
+    for(std::uint64_t r {0}; r < rangeCount; ++r) {
+        WorkerRange range {workerRange(seed, roundCount, r, rangeCount)};
+        std::uint64_t count {range.end - range.begin};
+        std::uint64_t samples {std::min(count, std::max(minSamples,
+                static_cast<std::uint64_t>(sampleFraction * static_cast<double>(count))))};
+        pending.push_back({.range = r, .state = range.state, .roundCount = count,
+            .sampleSeed = idealSeed(seed) ^ (r * 0x9e3779b97f4a7c15), .samples = samples});
+    }
+
+    Stopwatch stopwatch;
+    double verifySeconds {0};
+    std::uint64_t verifiedRounds {0};
+    std::uint64_t completed {0};
+    Int maxCount {0};
+    while(completed < rangeCount) {
+        for(WorkerProcess& worker : workers) {
+            if(worker.trusted && !worker.busy && !pending.empty()) {
+                worker.assignment = pending.front();
+                pending.pop_front();
+                try {
+                    writeAll(worker.fd, &worker.assignment, sizeof(worker.assignment));
+                } catch(const std::system_error& e) {
+                    if(e.code().value() != EPIPE && e.code().value() != ECONNRESET)
+                        throw;
+                    std::cerr << "Lost worker " << &worker - workers.data() << ", reassigning range "
+                        << worker.assignment.range << std::endl;
+                    worker.trusted = false;
+                    pending.push_front(worker.assignment);
+                    continue;
+                }
+                worker.busy = true;
+            }
+        }
+
+        std::vector<pollfd> fds;
+        std::vector<WorkerProcess*> polled;
+        for(WorkerProcess& worker : workers) {
+            if(worker.busy) {
+                fds.push_back({.fd = worker.fd, .events = POLLIN, .revents = 0});
+                polled.push_back(&worker);
+            }
+        }
+        if(fds.empty())
+            throw std::runtime_error {"No trusted worker left"};
+        if(poll(fds.data(), fds.size(), -1) < 0) {
+            if(errno == EINTR)
+                continue;
+            throwSystemError("poll");
+        }
+
+        for(std::size_t i {0}; i < fds.size(); ++i) {
+            if(fds[i].revents == 0)
+                continue;
+            WorkerProcess& worker {*polled[i]};
+            std::size_t w {static_cast<std::size_t>(&worker - workers.data())};
+            worker.busy = false;
+
+            WorkerReport report;
+            std::string problem;
+            try {
+                if(!readAll(worker.fd, &report.header, sizeof(report.header)))
+                    throw std::runtime_error {"worker exited"};
+                if(report.header.range != worker.assignment.range
+                        || report.header.top > verifiedTopRounds)
+                    throw std::runtime_error {"malformed report"};
+                report.top.resize(report.header.top);
+                report.samples.resize(worker.assignment.samples);
+                readAll(worker.fd, report.top.data(), report.top.size() * sizeof(RoundHit));
+                readAll(worker.fd, report.samples.data(),
+                        report.samples.size() * sizeof(RoundHit));
+
+                Stopwatch verify;
+                problem = verifyReport(worker.assignment, report, verifiedRounds);
+                verifySeconds += verify.seconds();
+            } catch(const std::exception& e) {
+                problem = e.what();
+            }
+
+            if(problem.empty()) {
+                maxCount = std::max(maxCount, report.header.maxCount);
+                ++completed;
+            } else {
+                std::cerr << "Rejected range " << worker.assignment.range << " from worker "
+                    << w << ": " << problem << ", reassigning it" << std::endl;
+                worker.trusted = false;
+                pending.push_front(worker.assignment);
+            }
+        }
+    }
+    double seconds {stopwatch.seconds()};
+
+    for(WorkerProcess& worker : workers) {
+        close(worker.fd);
+        waitpid(worker.pid, nullptr, 0);
+    }
+
+    std::cerr << "Verified " << rangeCount << " ranges of " << roundCount << " rounds on "
+        << workerCount << " workers in " << seconds << " s" << std::endl;
+    std::cerr << "Recomputed " << verifiedRounds << " rounds ("
+        << 100.0 * static_cast<double>(verifiedRounds) / static_cast<double>(roundCount)
+        << "% of the rounds) in " << verifySeconds << " s" << std::endl;
+    std::cerr << "Found at max " << maxCount << " hits" << std::endl;
+    return 0;
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+
+/*
+ * A round needs as many 32-bit words as calculateRound generates outputs.
+ */
+static inline constexpr std::size_t wordsPerRound {completeAttempts + 1};
+static inline constexpr std::size_t bytesPerRound {wordsPerRound * sizeof(Int)};
+static inline constexpr std::size_t defaultReadBuffer {std::size_t{64} << 20};
+
+/*
+ * calculateRound on recorded outputs instead of generated ones. The words are
+ * read in host byte order and need not be aligned.
+ */
+[[nodiscard]] inline Int calculateRecordedRound(const std::uint8_t* data) noexcept {
+    Int words[wordsPerRound];
+    std::memcpy(words, data, bytesPerRound);
+
+    Int count {0};
+    for(std::size_t i {0}; i < completeAttempts; ++i)
+        count += countPairwiseZeroBits(words[i]);
+    return count + countPairwiseZeroBits(words[completeAttempts] & remainingAttemptsBitmask);
+}
+
+struct RecordedResult {
+    std::uint64_t rounds {0};
+    Int maxCount {0};
+
+    void merge(const RecordedResult& other) noexcept {
+        rounds += other.rounds;
+        maxCount = std::max(maxCount, other.maxCount);
+    }
+};
+
+/*
+ * Scores every whole round in 'size' bytes; the rounds are independent, so
+ * the threads simply split them.
+ */
+[[nodiscard]] inline RecordedResult runRecordedRounds(const std::uint8_t* data,
+        std::size_t size) noexcept {
+    std::uint64_t roundCount {size / bytesPerRound};
+    Int maxCount {0};
+
+    # pragma omp parallel for schedule(static) reduction(max:maxCount)
+    for(std::uint64_t i = 0; i < roundCount; ++i)
+        maxCount = std::max(maxCount, calculateRecordedRound(data + i * bytesPerRound));
+
+    return RecordedResult {.rounds = roundCount, .maxCount = maxCount};
+}
+
+class FileDescriptor {
+    int fd;
+
+public:
+    explicit FileDescriptor(int descriptor) noexcept: fd{descriptor} {}
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+    FileDescriptor(FileDescriptor&& other) noexcept: fd{std::exchange(other.fd, -1)} {}
+    FileDescriptor& operator=(FileDescriptor&& other) noexcept {
+        std::swap(fd, other.fd);
+        return *this;
+    }
+    ~FileDescriptor() {
+        if(fd > STDERR_FILENO)
+            close(fd);
+    }
+
+    [[nodiscard]] int get() const noexcept {
+        return fd;
+    }
+};
+
+[[noreturn]] inline void throwSystemError(const std::string& what) {
+    throw std::system_error {errno, std::generic_category(), what};
+}
+
+/*
+ * A shared mapping of 'bytes' of a file from 'offset' on, unmapped when
+ * destroyed.
+ */
+class SharedMapping {
+    void* address {MAP_FAILED};
+    std::uint64_t size {0};
+
+public:
+    SharedMapping() = default;
+    SharedMapping(int fd, std::uint64_t bytes, int protection, off_t offset = 0)
+        : address{mmap(nullptr, bytes, protection, MAP_SHARED, fd, offset)}, size{bytes} {
+        if(address == MAP_FAILED)
+            throwSystemError("mmap");
+    }
+
+    SharedMapping(const SharedMapping&) = delete;
+    SharedMapping& operator=(const SharedMapping&) = delete;
+    SharedMapping(SharedMapping&& other) noexcept
+        : address{std::exchange(other.address, MAP_FAILED)}, size{std::exchange(other.size, 0)} {}
+    SharedMapping& operator=(SharedMapping&& other) noexcept {
+        std::swap(address, other.address);
+        std::swap(size, other.size);
+        return *this;
+    }
+
+    ~SharedMapping() {
+        if(address != MAP_FAILED)
+            munmap(address, size);
+    }
+
+    [[nodiscard]] std::uint8_t* data() const noexcept {
+        return static_cast<std::uint8_t*>(address);
+    }
+};
+
+/*
+ * Maps a regular file and scores it in place.
+ */
+[[nodiscard]] inline RecordedResult runMappedFile(int fd, std::size_t size) {
+    if(size < bytesPerRound)
+        return RecordedResult {};
+
+    void* mapping {mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)};
+    if(mapping == MAP_FAILED)
+        throwSystemError("mmap");
+    madvise(mapping, size, MADV_SEQUENTIAL);
+
+    RecordedResult result {runRecordedRounds(static_cast<const std::uint8_t*>(mapping), size)};
+    munmap(mapping, size);
+    return result;
+}
+
+/*
+ * Reads a pipe into a large page-aligned buffer and scores every filling of it
+ * in parallel. A partial round at the end of a filling is moved to the front.
+ */
+[[nodiscard]] inline RecordedResult runStream(int fd, std::size_t bufferSize) {
+    bufferSize = std::max(bufferSize / bytesPerRound, std::size_t{1}) * bytesPerRound;
+    std::unique_ptr<std::uint8_t[], decltype(&std::free)> buffer
+        {static_cast<std::uint8_t*>(std::aligned_alloc(4096,
+                (bufferSize + 4095) / 4096 * 4096)), &std::free};
+    if(!buffer)
+        throw std::bad_alloc {};
+
+    RecordedResult result;
+    std::size_t filled {0};
+    bool done {false};
+    while(!done) {
+        while(filled < bufferSize) {
+            ssize_t n {read(fd, buffer.get() + filled, bufferSize - filled)};
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n < 0)
+                throwSystemError("read");
+            if(n == 0) {
+                done = true;
+                break;
+            }
+            filled += static_cast<std::size_t>(n);
+        }
+
+        result.merge(runRecordedRounds(buffer.get(), filled));
+        std::size_t used {filled / bytesPerRound * bytesPerRound};
+        std::memmove(buffer.get(), buffer.get() + used, filled - used);
+        filled -= used;
+    }
+
+    return result;
+}
+
+/*
+ * Runs the challenge on recorded 32-bit words from 'input=' (a file or '-' for
+ * stdin), 15 words per round, instead of on nextRandomNumber.
+ */
+inline int runExternalMode(const Options& options, State) {
+    std::string input {options.getString("input", "-")};
+    std::size_t bufferSize {options.getUnsigned("buffer", defaultReadBuffer)};
+
+    FileDescriptor fd {input == "-" ? STDIN_FILENO : open(input.c_str(), O_RDONLY)};
+    if(fd.get() < 0)
+        throwSystemError(input);
+
+    struct stat info;
+    if(fstat(fd.get(), &info) != 0)
+        throwSystemError(input);
+
+    Stopwatch stopwatch;
+    bool mapped {S_ISREG(info.st_mode)};
+    RecordedResult result {mapped
+        ? runMappedFile(fd.get(), static_cast<std::size_t>(info.st_size))
+        : runStream(fd.get(), bufferSize)};
+    double seconds {stopwatch.seconds()};
+
+    std::cerr << "Read " << result.rounds << " rounds from "
+        << (mapped ? "a mapped file" : "a stream") << " in " << seconds << " s ("
+        << result.rounds * bytesPerRound / seconds / 1e6 << " MB/s)" << std::endl;
+    std::cerr << "Found at max " << result.maxCount << " hits" << std::endl;
+    return 0;
+}
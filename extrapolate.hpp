@@ -0,0 +1,345 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <numbers>
+#include <stdexcept>
+#include <vector>
+
+#include "binomial.hpp"
+#include "ideal.hpp"
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+#include "xoshiro.hpp"
+
+static inline constexpr std::uint64_t defaultShortRounds {10'000'000};
+static inline constexpr std::uint64_t defaultBlockRounds {10'000};
+static inline constexpr int bootstrapSamples {200};
+// Tail bins with fewer rounds than this are too noisy to fit.
+static inline constexpr double minTailRounds {5};
+
+/*
+ * What a short run keeps: how many rounds had how many hits, and the maximum
+ * of every block of 'blockRounds' consecutive rounds of a thread.
+ */
+struct ShortRun {
+    Histogram histogram {};
+    std::vector<Int> blockMaxima;
+};
+
+[[nodiscard]] inline ShortRun runShortSimulation(State state,
+        std::uint64_t roundCount, std::uint64_t blockRounds) {
+    ShortRun run;
+
+    forEachWorker(state, roundCount,
+            [&](State& generator, std::uint64_t begin, std::uint64_t end) {
+        ShortRun local;
+        Int blockMax {0};
+        std::uint64_t inBlock {0};
+        for(std::uint64_t i {begin}; i < end; ++i) {
+            Int count {calculateRound(deriveNewState(generator))};
+            ++local.histogram[count];
+            blockMax = std::max(blockMax, count);
+            if(++inBlock == blockRounds) {
+                local.blockMaxima.push_back(blockMax);
+                blockMax = 0;
+                inBlock = 0;
+            }
+        }
+
+        # pragma omp critical
+        {
+            for(Int k = 0; k <= attempts; ++k)
+                run.histogram[k] += local.histogram[k];
+            run.blockMaxima.insert(run.blockMaxima.end(),
+                    local.blockMaxima.begin(), local.blockMaxima.end());
+        }
+    });
+
+    return run;
+}
+
+/*
+ * A predicted distribution of the maximum of many rounds, as P(max <= k).
+ */
+struct MaxPrediction {
+    std::array<double, attempts + 1> atMost {};
+
+    [[nodiscard]] double expected() const noexcept {
+        double sum {0};
+        for(Int k = 0; k < attempts; ++k)
+            sum += 1 - atMost[k];
+        return sum;
+    }
+
+    [[nodiscard]] Int quantile(double q) const noexcept {
+        for(Int k = 0; k < attempts; ++k)
+            if(atMost[k] >= q)
+                return k;
+        return attempts;
+    }
+};
+
+/*
+ * Solves the first 'n' of the normal equations in 'm' (the coefficients, then
+ * the right-hand side in column 3) by Gauss-Jordan elimination with partial
+ * pivoting. Returns false if they are singular relative to their scale.
+ */
+[[nodiscard]] inline bool solveNormalEquations(double (&m)[3][4], int n,
+        std::array<double, 3>& solution) noexcept {
+    double scale {0};
+    for(int i {0}; i < n; ++i)
+        for(int j {0}; j < n; ++j)
+            scale = std::max(scale, std::abs(m[i][j]));
+
+    double a[3][4] {};
+    for(int i {0}; i < n; ++i) {
+        for(int j {0}; j < n; ++j)
+            a[i][j] = m[i][j];
+        a[i][3] = m[i][3];
+    }
+    for(int i {0}; i < n; ++i) {
+        int pivot {i};
+        for(int r {i + 1}; r < n; ++r)
+            if(std::abs(a[r][i]) > std::abs(a[pivot][i]))
+                pivot = r;
+        if(!(std::abs(a[pivot][i]) > 1e-12 * scale))
+            return false;
+        std::swap(a[i], a[pivot]);
+        for(int r {0}; r < n; ++r) {
+            if(r == i)
+                continue;
+            double factor {a[r][i] / a[i][i]};
+            for(int c {i}; c < 4; ++c)
+                a[r][c] -= factor * a[i][c];
+        }
+    }
+    solution = {};
+    for(int i {0}; i < n; ++i)
+        solution[i] = a[i][3] / a[i][i];
+    return true;
+}
+
+/*
+ * Fits log P(X >= k) of the per-round counts with a quadratic in k over the
+ * upper half of the histogram, weighting every bin by its number of rounds,
+ * and predicts P(max of R rounds <= k) = (1 - P(X >= k + 1))^R. Below the fit
+ * the empirical tail is used. The quadratic captures the bending of a
+ * binomial-like tail that a straight (exponential) tail would miss. A
+ * quadratic that bends upwards, so that the tail would grow again, or that
+ * the bins cannot determine is replaced by a straight line. At least three
+ * bins need 'minTailRounds' rounds.
+ */
+[[nodiscard]] inline MaxPrediction predictFromTail(const Histogram& histogram,
+        long double targetRounds) {
+    double total {0};
+    double weightedSum {0};
+    for(Int k = 0; k <= attempts; ++k) {
+        total += histogram[k];
+        weightedSum += static_cast<double>(k) * histogram[k];
+    }
+    if(total == 0)
+        throw std::invalid_argument {"No rounds to fit"};
+
+    std::array<double, attempts + 2> survival {};
+    for(Int k = attempts + 1; k-- > 0;)
+        survival[k] = survival[k + 1] + histogram[k] / total;
+
+    // Normal equations of the weighted least squares fit y = a + b d + c d^2
+    // with d = k - first.
+    Int first {static_cast<Int>(std::ceil(weightedSum / total))};
+    double m[3][4] {};
+    int bins {0};
+    for(Int k = first; k <= attempts; ++k, ++bins) {
+        double rounds {survival[k] * total};
+        if(rounds < minTailRounds)
+            break;
+        double d {static_cast<double>(k - first)};
+        double x[3] {1, d, d * d};
+        double y {std::log(survival[k])};
+        for(int i {0}; i < 3; ++i) {
+            for(int j {0}; j < 3; ++j)
+                m[i][j] += rounds * x[i] * x[j];
+            m[i][3] += rounds * x[i] * y;
+        }
+    }
+
+    if(bins < 3)
+        throw std::invalid_argument {"Too few rounds in the tail to fit"};
+    std::array<double, 3> fit;
+    if(!solveNormalEquations(m, 3, fit) || fit[2] > 0)
+        if(!solveNormalEquations(m, 2, fit) || fit[1] > 0)
+            throw std::invalid_argument {"The tail cannot be fitted"};
+    auto [a, b, c] {fit};
+
+    MaxPrediction prediction;
+    for(Int k = 0; k <= attempts; ++k) {
+        Int next {k + 1};
+        double d {static_cast<double>(next) - first};
+        // Rounding can take the summed survival a little above 1.
+        double tail {std::min(1.0, next < first ? survival[next]
+            : std::exp(a + b * d + c * d * d))};
+        if(next > attempts)
+            tail = 0;
+        prediction.atMost[k] = static_cast<double>(
+                std::exp(targetRounds * std::log1p(-static_cast<long double>(tail))));
+    }
+
+    return prediction;
+}
+
+/*
+ * Fits a Gumbel distribution to the block maxima by moments. The maximum of
+ * R rounds is the maximum of R / blockRounds blocks, which shifts the location
+ * by scale * ln(R / blockRounds). The continuous fit is rounded to counts.
+ */
+[[nodiscard]] inline MaxPrediction predictFromBlocks(const std::vector<Int>& maxima,
+        std::uint64_t blockRounds, long double targetRounds) {
+    if(maxima.size() < 2)
+        throw std::invalid_argument {"Need at least two blocks"};
+
+    double mean {0};
+    for(Int x : maxima)
+        mean += x;
+    mean /= maxima.size();
+    double variance {0};
+    for(Int x : maxima)
+        variance += (x - mean) * (x - mean);
+    variance /= maxima.size() - 1;
+    if(variance == 0)
+        throw std::invalid_argument {"All block maxima are equal"};
+
+    double scale {std::sqrt(6 * variance) / std::numbers::pi};
+    double location {mean - std::numbers::egamma * scale
+        + scale * static_cast<double>(std::log(targetRounds / blockRounds))};
+
+    MaxPrediction prediction;
+    for(Int k = 0; k <= attempts; ++k)
+        prediction.atMost[k] = std::exp(-std::exp(-(k + 0.5 - location) / scale));
+    return prediction;
+}
+
+/*
+ * Poisson draws for resampling a histogram; large means use the normal
+ * approximation.
+ */
+[[nodiscard]] inline std::uint64_t drawPoisson(Xoshiro256& generator, double mean) {
+    if(mean > 30) {
+        double u1 {1 - generator.uniform()};
+        double u2 {generator.uniform()};
+        double z {std::sqrt(-2 * std::log(u1)) * std::cos(2 * std::numbers::pi * u2)};
+        return static_cast<std::uint64_t>(std::max(0.0, std::round(mean + std::sqrt(mean) * z)));
+    }
+
+    double limit {std::exp(-mean)};
+    double product {generator.uniform()};
+    std::uint64_t n {0};
+    while(product > limit) {
+        ++n;
+        product *= generator.uniform();
+    }
+    return n;
+}
+
+struct Interval {
+    double low;
+    double high;
+};
+
+[[nodiscard]] inline Interval percentileInterval(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return Interval {.low = values[values.size() * 25 / 1000],
+                     .high = values[values.size() * 975 / 1000]};
+}
+
+inline void reportPrediction(const char* model, const MaxPrediction& prediction,
+        Interval expectedInterval) {
+    std::cerr << model << ": expected max " << std::setprecision(4)
+        << prediction.expected() << " (95% CI " << expectedInterval.low << " to "
+        << expectedInterval.high << "), median " << prediction.quantile(0.5)
+        << ", 90% prediction interval " << prediction.quantile(0.05) << " to "
+        << prediction.quantile(0.95) << std::endl;
+}
+
+/*
+ * Predicts the maximum of 'target=' rounds from a run of 'rounds=' rounds,
+ * with bootstrap confidence intervals, using a fit of the per-round tail and
+ * a Gumbel fit of block maxima. 'validate=n' then runs n full simulations with
+ * seeds u, u + 1, ... and counts how many maxima fall into each model's 90%
+ * prediction interval.
+ */
+inline int runExtrapolateMode(const Options& options, State seed) {
+    std::uint64_t shortRounds {options.getUnsigned("rounds", defaultShortRounds)};
+    std::uint64_t targetRounds {options.getUnsigned("target", rounds)};
+    std::uint64_t blockRounds {options.getUnsigned("block", defaultBlockRounds)};
+    std::uint64_t validations {options.getUnsigned("validate", 0)};
+    if(blockRounds == 0)
+        throw std::invalid_argument {"block must be positive"};
+    long double target {static_cast<long double>(targetRounds)};
+
+    Stopwatch stopwatch;
+    ShortRun run {runShortSimulation(seed, shortRounds, blockRounds)};
+    std::cerr << "Ran " << shortRounds << " rounds in " << stopwatch.seconds()
+        << " s, predicting the maximum of " << targetRounds << " rounds"
+        << std::endl;
+
+    MaxPrediction tail {predictFromTail(run.histogram, target)};
+    MaxPrediction blocks {predictFromBlocks(run.blockMaxima, blockRounds, target)};
+
+    Xoshiro256 generator {idealSeed(seed)};
+    std::vector<double> tailExpected;
+    std::vector<double> blockExpected;
+    for(int i {0}; i < bootstrapSamples; ++i) {
+        Histogram resampled;
+        for(Int k = 0; k <= attempts; ++k)
+            resampled[k] = drawPoisson(generator, static_cast<double>(run.histogram[k]));
+        // A resample can leave too few rounds in the tail or only equal block
+        // maxima; it is skipped.
+        try {
+            tailExpected.push_back(predictFromTail(resampled, target).expected());
+        } catch(const std::invalid_argument&) {}
+
+        std::vector<Int> maxima(run.blockMaxima.size());
+        for(Int& x : maxima)
+            x = run.blockMaxima[generator() % run.blockMaxima.size()];
+        try {
+            blockExpected.push_back(predictFromBlocks(maxima, blockRounds, target).expected());
+        } catch(const std::invalid_argument&) {}
+    }
+
+    if(tailExpected.empty() || blockExpected.empty())
+        throw std::invalid_argument {"No bootstrap resample could be fitted"};
+    if(tailExpected.size() < bootstrapSamples || blockExpected.size() < bootstrapSamples)
+        std::cerr << "Dropped " << bootstrapSamples - tailExpected.size() << " tail fit and "
+            << bootstrapSamples - blockExpected.size() << " Gumbel fit resamples of "
+            << bootstrapSamples << " that could not be fitted" << std::endl;
+    reportPrediction("Tail fit", tail, percentileInterval(tailExpected));
+    reportPrediction("Gumbel fit", blocks, percentileInterval(blockExpected));
+
+    Binomial binomial;
+    std::cerr << "Ideal rounds: expected max " << binomial.expectedMax(target)
+        << ", 90% interval " << binomial.maxQuantile(0.05L, target) << " to "
+        << binomial.maxQuantile(0.95L, target) << std::endl;
+
+    int tailHits {0};
+    int blockHits {0};
+    for(std::uint64_t i {0}; i < validations; ++i) {
+        State validationSeed {.u = seed.u + static_cast<Int>(i), .v = seed.v};
+        Int observed {runSimulation(validationSeed, targetRounds, calculateRound)};
+        tailHits += observed >= tail.quantile(0.05) && observed <= tail.quantile(0.95);
+        blockHits += observed >= blocks.quantile(0.05) && observed <= blocks.quantile(0.95);
+        std::cerr << "Full run " << i + 1 << " found at max " << observed << " hits"
+            << std::endl;
+    }
+    if(validations != 0)
+        std::cerr << "Inside the 90% prediction interval: tail fit " << tailHits
+            << "/" << validations << ", Gumbel fit " << blockHits << "/"
+            << validations << std::endl;
+
+    return 0;
+}
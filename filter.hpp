@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "options.hpp"
+#include "rng.hpp"
+#include "score_table.hpp"
+#include "simulation.hpp"
+
+/*
+ * Counts the hits of one half like calculateHalf, but gives up as soon as the
+ * remaining outputs cannot lift the count to 'needed' anymore and then returns
+ * a count below 'needed'. 'outputs' is increased by the outputs generated.
+ */
+[[nodiscard]] inline Int calculateBoundedHalf(Int seed, Half half, Int needed,
+        std::uint64_t& outputs) noexcept {
+    Int count {0};
+    Int reachable {maxScoreOf(half)};
+    for(Int i = 0; i < completeAttempts; ++i) {
+        if(count + reachable < needed)
+            return count;
+
+        seed = nextHalf(seed, half.multiplier);
+        ++outputs;
+        count += countPairwiseZeroBits(seed & lowerHalfBitMask);
+        reachable -= numberOfExtractedPairs / 2;
+    }
+
+    if(count + reachable < needed)
+        return count;
+
+    seed = nextHalf(seed, half.multiplier);
+    ++outputs;
+    return count + countPairwiseZeroBits(seed & half.lastBitmask);
+}
+
+struct FilterResult {
+    Int maxCount {0};
+    std::uint64_t aboveThreshold {0};
+    std::uint64_t skippedV {0};
+    std::uint64_t outputsV {0};
+};
+
+/*
+ * Scores the u half of every round first. The v half is only generated while
+ * the u score plus the hits the v half can still add reach the running maximum
+ * of the thread or 'threshold' (0 for a plain maximum). A round that cannot
+ * matter is abandoned, possibly before its first v output. The rounds are the
+ * same as the ones of runSimulation, so the maximum is exact.
+ */
+template<typename ScoreU>
+[[nodiscard]] FilterResult runFilteredSimulation(State state,
+        std::uint64_t roundCount, const ScoreU& scoreU, Int threshold) noexcept {
+    FilterResult result;
+
+    forEachWorker(state, roundCount,
+            [&](State& generator, std::uint64_t begin, std::uint64_t end) {
+        FilterResult local;
+
+        for(std::uint64_t i {begin}; i < end; ++i) {
+            State round {deriveNewState(generator)};
+            Int u {scoreU(round.u)};
+            Int best {local.maxCount};
+            Int needed {threshold == 0 ? best + 1 : std::min(threshold, best + 1)};
+            if(u + maxScoreOf(halfV) < needed) {
+                ++local.skippedV;
+                continue;
+            }
+
+            Int count {u + calculateBoundedHalf(round.v, halfV,
+                    needed > u ? needed - u : 0, local.outputsV)};
+            local.maxCount = std::max(best, count);
+            local.aboveThreshold += threshold != 0 && count >= threshold;
+        }
+
+        # pragma omp critical
+        {
+            result.maxCount = std::max(result.maxCount, local.maxCount);
+            result.aboveThreshold += local.aboveThreshold;
+            result.skippedV += local.skippedV;
+            result.outputsV += local.outputsV;
+        }
+    });
+
+    return result;
+}
+
+template<typename Kernel, typename ScoreU>
+[[nodiscard]] bool reportFilterRun(const std::string& format, State seed,
+        std::uint64_t roundCount, const Kernel& kernel, const ScoreU& scoreU,
+        Int threshold) {
+    Stopwatch plain;
+    Int plainMax {runSimulation(seed, roundCount, kernel)};
+    double plainSeconds {plain.seconds()};
+
+    Stopwatch filtered;
+    FilterResult result {runFilteredSimulation(seed, roundCount, scoreU,
+            threshold)};
+    double filteredSeconds {filtered.seconds()};
+
+    double outputs {static_cast<double>(roundCount) * (completeAttempts + 1)};
+    std::cerr << format << " unfiltered: "
+        << static_cast<std::uint64_t>(roundCount / plainSeconds)
+        << " rounds/s, max " << plainMax << std::endl;
+    std::cerr << format << " filtered: "
+        << static_cast<std::uint64_t>(roundCount / filteredSeconds)
+        << " rounds/s, max " << result.maxCount << ", v half skipped in "
+        << 100.0 * result.skippedV / roundCount << "% of the rounds, "
+        << 100.0 * (1 - result.outputsV / outputs)
+        << "% of the v outputs skipped, speedup "
+        << plainSeconds / filteredSeconds << std::endl;
+    if(threshold != 0)
+        std::cerr << result.aboveThreshold << " rounds with at least "
+            << threshold << " hits" << std::endl;
+
+    if(plainMax != result.maxCount) {
+        std::cerr << "The maxima differ" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Compares the two-phase filter against scoring every round in full. The u half
+ * is computed (format=compute, compared against calculateRound) or looked up in
+ * a table of the u half only; the v half is always computed.
+ */
+inline int runFilterMode(const Options& options, State seed) {
+    std::string format {options.getString("format", "compute")};
+    std::uint64_t roundCount {options.getUnsigned("rounds", rounds)};
+    Int threshold {static_cast<Int>(options.getUnsigned("threshold", 0))};
+    bool ok {true};
+
+    if(format == "compute") {
+        ok = reportFilterRun(format, seed, roundCount, calculateRound,
+                [](Int u) { return calculateHalf(u, halfU); }, threshold);
+    } else if(!visitHalfTable(format, halfU, [&](const auto& table) {
+        auto score {[&](Int u) { return table.score(u); }};
+        ok = reportFilterRun(format, seed, roundCount, [&](State round) {
+            return score(round.u) + calculateHalf(round.v, halfV);
+        }, score, threshold);
+    })) {
+        throw std::invalid_argument {"Unknown table format '" + format + "'"};
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "simulation.hpp"
+
+static inline constexpr double defaultEnvironmentInterval {0.1};
+
+/*
+ * Running sums of what the CPUs did: clock frequencies, temperatures and
+ * throttling, sampled by an EnvironmentMonitor. Two snapshots give the
+ * averages in between; the extremes are those since the monitor last
+ * restarted them.
+ */
+struct EnvironmentTotals {
+    std::uint64_t samples {0};
+    double ghzSum {0};
+    double minGhz {std::numeric_limits<double>::infinity()};
+    double maxGhz {0};
+    double maxCelsius {-std::numeric_limits<double>::infinity()};
+    double throttledSeconds {0};
+
+    /*
+     * Adds what happened between two snapshots, e.g. to sum up phases. The
+     * extremes of 'to' must have been restarted at 'from'.
+     */
+    void add(const EnvironmentTotals& from, const EnvironmentTotals& to) noexcept {
+        samples += to.samples - from.samples;
+        ghzSum += to.ghzSum - from.ghzSum;
+        throttledSeconds += to.throttledSeconds - from.throttledSeconds;
+        minGhz = std::min(minGhz, to.minGhz);
+        maxGhz = std::max(maxGhz, to.maxGhz);
+        maxCelsius = std::max(maxCelsius, to.maxCelsius);
+    }
+};
+
+/*
+ * The environment between two snapshots. Values the host does not expose are
+ * left out of the report.
+ */
+struct EnvironmentReport {
+    double ghz {0};
+    double minGhz {0};
+    double maxGhz {0};
+    double maxCelsius {0};
+    double throttledSeconds {0};
+    bool hasFrequency {false};
+    bool hasTemperature {false};
+    bool hasThrottling {false};
+
+    // Cycles per round from the average clock, if all 'threads' ran busy.
+    [[nodiscard]] double cyclesPerRound(double roundsPerSecond, unsigned threads) const noexcept {
+        return ghz * 1e9 * threads / roundsPerSecond;
+    }
+
+    void print(std::ostream& out) const {
+        if(hasFrequency)
+            out << std::fixed << std::setprecision(2) << ghz << " GHz (" << minGhz << " to "
+                << maxGhz << ")" << std::defaultfloat << std::setprecision(6);
+        if(hasTemperature)
+            out << (hasFrequency ? ", " : "") << "max " << maxCelsius << " C";
+        if(hasThrottling)
+            out << (hasFrequency || hasTemperature ? ", " : "") << "throttled "
+                << throttledSeconds << " s";
+    }
+};
+
+/*
+ * Samples every 'interval' seconds on a thread of its own:
+ * - the clock of every CPU from cpufreq, or the "cpu MHz" of /proc/cpuinfo
+ *   where there is no cpufreq,
+ * - the temperature of every thermal zone,
+ * - throttling: the time the x86 thermal_throttle counters report, or the
+ *   time the Raspberry Pi firmware reports being throttled or capped.
+ */
+class EnvironmentMonitor {
+    std::vector<std::filesystem::path> frequencyFiles;
+    std::vector<std::filesystem::path> temperatureFiles;
+    std::vector<std::filesystem::path> throttleFiles;
+    std::vector<double> throttleStart;
+    std::filesystem::path firmwareThrottle {"/sys/devices/platform/soc/soc:firmware/get_throttled"};
+    bool useCpuinfo {false};
+    bool hasFirmwareThrottle {false};
+    double interval;
+
+    std::mutex mutex;
+    std::condition_variable stopped;
+    bool stopping {false};
+    EnvironmentTotals totals;
+    std::thread sampler;
+
+    [[nodiscard]] static bool readNumber(const std::filesystem::path& path, double& value) {
+        std::ifstream in {path};
+        std::string text;
+        if(!(in >> text))
+            return false;
+        try {
+            value = static_cast<double>(std::stoull(text, nullptr, 0));
+            return true;
+        } catch(const std::exception&) {
+            return false;
+        }
+    }
+
+    [[nodiscard]] std::vector<double> readGhz() const {
+        std::vector<double> ghz;
+        double value {0};
+        for(const auto& path : frequencyFiles)
+            if(readNumber(path, value))
+                ghz.push_back(value / 1e6);
+        if(useCpuinfo) {
+            std::ifstream in {"/proc/cpuinfo"};
+            for(std::string line; std::getline(in, line);) {
+                std::size_t colon {line.find(':')};
+                if(!line.starts_with("cpu MHz") || colon == std::string::npos)
+                    continue;
+                std::size_t start {line.find_first_not_of(" \t", colon + 1)};
+                if(start == std::string::npos)
+                    continue;
+                double mhz {0};
+                auto [end, error] {std::from_chars(line.data() + start, line.data() + line.size(), mhz)};
+                if(error == std::errc {} && mhz > 0)
+                    ghz.push_back(mhz / 1e3);
+            }
+        }
+        return ghz;
+    }
+
+    void sample(double seconds) {
+        std::vector<double> ghz {readGhz()};
+        double celsius {-std::numeric_limits<double>::infinity()};
+        double value {0};
+        for(const auto& path : temperatureFiles)
+            if(readNumber(path, value))
+                celsius = std::max(celsius, value / 1000);
+
+        double throttled {0};
+        for(std::size_t i {0}; i < throttleFiles.size(); ++i)
+            if(readNumber(throttleFiles[i], value))
+                throttled = std::max(throttled, (value - throttleStart[i]) / 1000);
+
+        // Bit 1: frequency capped, bit 2: currently throttled.
+        bool firmwareThrottled {hasFirmwareThrottle && readNumber(firmwareThrottle, value)
+            && (static_cast<std::uint64_t>(value) & 0x6) != 0};
+
+        std::lock_guard lock {mutex};
+        ++totals.samples;
+        for(double g : ghz) {
+            totals.ghzSum += g / static_cast<double>(ghz.size());
+            totals.minGhz = std::min(totals.minGhz, g);
+            totals.maxGhz = std::max(totals.maxGhz, g);
+        }
+        totals.maxCelsius = std::max(totals.maxCelsius, celsius);
+        if(!throttleFiles.empty())
+            totals.throttledSeconds = throttled;
+        else if(firmwareThrottled)
+            totals.throttledSeconds += seconds;
+    }
+
+public:
+    explicit EnvironmentMonitor(double seconds = defaultEnvironmentInterval) : interval{seconds} {
+        namespace fs = std::filesystem;
+        std::error_code error;
+        for(const auto& entry : fs::directory_iterator {"/sys/devices/system/cpu", error}) {
+            std::string name {entry.path().filename().string()};
+            if(!name.starts_with("cpu") || name.size() == 3
+                    || name.find_first_not_of("0123456789", 3) != std::string::npos)
+                continue;
+            if(fs::exists(entry.path() / "cpufreq/scaling_cur_freq", error))
+                frequencyFiles.push_back(entry.path() / "cpufreq/scaling_cur_freq");
+            if(fs::exists(entry.path() / "thermal_throttle/core_throttle_total_time_ms", error))
+                throttleFiles.push_back(entry.path() / "thermal_throttle/core_throttle_total_time_ms");
+        }
+        for(const auto& entry : fs::directory_iterator {"/sys/class/thermal", error})
+            if(entry.path().filename().string().starts_with("thermal_zone")
+                    && fs::exists(entry.path() / "temp", error))
+                temperatureFiles.push_back(entry.path() / "temp");
+
+        useCpuinfo = frequencyFiles.empty();
+        hasFirmwareThrottle = fs::exists(firmwareThrottle, error);
+        for(const auto& path : throttleFiles) {
+            double start {0};
+            throttleStart.push_back(readNumber(path, start) ? start : 0);
+        }
+
+        sample(0);
+        sampler = std::thread {[this] {
+            std::unique_lock lock {mutex};
+            while(!stopped.wait_for(lock, std::chrono::duration<double>(interval),
+                    [&] { return stopping; })) {
+                lock.unlock();
+                sample(interval);
+                lock.lock();
+            }
+        }};
+    }
+
+    EnvironmentMonitor(const EnvironmentMonitor&) = delete;
+    EnvironmentMonitor& operator=(const EnvironmentMonitor&) = delete;
+
+    ~EnvironmentMonitor() {
+        {
+            std::lock_guard lock {mutex};
+            stopping = true;
+        }
+        stopped.notify_all();
+        sampler.join();
+    }
+
+    [[nodiscard]] EnvironmentTotals snapshot() {
+        std::lock_guard lock {mutex};
+        return totals;
+    }
+
+    // Forgets the extremes so far, for those of the phase that starts now.
+    void restartExtremes() {
+        std::lock_guard lock {mutex};
+        EnvironmentTotals fresh;
+        totals.minGhz = fresh.minGhz;
+        totals.maxGhz = fresh.maxGhz;
+        totals.maxCelsius = fresh.maxCelsius;
+    }
+
+    /*
+     * The environment between two snapshots; the extremes are those of 'to',
+     * since the monitor started or last restarted them.
+     */
+    [[nodiscard]] EnvironmentReport report(const EnvironmentTotals& from,
+            const EnvironmentTotals& to) const {
+        EnvironmentReport result;
+        std::uint64_t samples {to.samples - from.samples};
+        result.hasFrequency = samples != 0 && to.maxGhz > 0;
+        if(result.hasFrequency) {
+            result.ghz = (to.ghzSum - from.ghzSum) / static_cast<double>(samples);
+            result.minGhz = to.minGhz;
+            result.maxGhz = to.maxGhz;
+        }
+        result.hasTemperature = std::isfinite(to.maxCelsius);
+        result.maxCelsius = to.maxCelsius;
+        result.hasThrottling = !throttleFiles.empty() || hasFirmwareThrottle;
+        result.throttledSeconds = to.throttledSeconds - from.throttledSeconds;
+        return result;
+    }
+};
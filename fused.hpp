@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <iostream>
+#include <utility>
+
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+
+/*
+ * An attempt with a chance of 1/2^bits hits if 'bits' consecutive bits of an
+ * output are all set. An output holds bitSize / bits such attempts, e.g. 16
+ * pairs for 1/4 or 10 triples (ignoring the top two bits) for 1/8.
+ */
+template<Int bits>
+struct Probability {
+    static inline constexpr Int attemptsPerOutput {bitSize / bits};
+    static inline constexpr Int outputs
+        {(attempts + attemptsPerOutput - 1) / attemptsPerOutput};
+    static inline constexpr Int lastAttempts
+        {attempts - (outputs - 1) * attemptsPerOutput};
+
+    // The lowest bit of each of the first 'count' groups of an output.
+    [[nodiscard]] static constexpr Int groupBitmask(Int count) noexcept {
+        Int mask {0};
+        for(Int i = 0; i < count; ++i)
+            mask |= static_cast<Int>(1) << (i * bits);
+        return mask;
+    }
+
+    static inline constexpr Int fullBitmask {groupBitmask(attemptsPerOutput)};
+    static inline constexpr Int lastBitmask {groupBitmask(lastAttempts)};
+
+    [[nodiscard]] static constexpr Int countHits(Int n, Int mask) noexcept {
+        Int allSet {n};
+        for(Int i = 1; i < bits; ++i)
+            allSet &= n >> i;
+        return std::popcount(allSet & mask);
+    }
+
+    // The hits in the i-th output of a round, 0 past the last one.
+    [[nodiscard]] static constexpr Int countOutput(Int n, Int i) noexcept {
+        if(i + 1 < outputs)
+            return countHits(n, fullBitmask);
+        return i + 1 == outputs ? countHits(n, lastBitmask) : 0;
+    }
+
+    /*
+     * calculateRound for this probability; Probability<2> agrees with it.
+     */
+    [[nodiscard]] static Int calculateRound(State state) noexcept {
+        Int count {0};
+        for(Int i = 0; i + 1 < outputs; ++i)
+            count += countHits(nextRandomNumber(state), fullBitmask);
+        return count + countHits(nextRandomNumber(state), lastBitmask);
+    }
+};
+
+static inline constexpr std::array<Int, 4> fusedBits {1, 2, 3, 4};
+static inline constexpr std::size_t fusedCount {fusedBits.size()};
+
+using FusedCounts = std::array<Int, fusedCount>;
+
+/*
+ * Scores a round for every probability at once. All of them read the same
+ * outputs from the start of the round, each as many as it needs.
+ */
+template<std::size_t... I>
+[[nodiscard]] FusedCounts calculateFusedRound(State state,
+        std::index_sequence<I...>) noexcept {
+    static constexpr Int outputs
+        {std::max({Probability<fusedBits[I]>::outputs...})};
+
+    FusedCounts counts {};
+    for(Int i = 0; i < outputs; ++i) {
+        Int n {nextRandomNumber(state)};
+        ((counts[I] += Probability<fusedBits[I]>::countOutput(n, i)), ...);
+    }
+
+    return counts;
+}
+
+[[nodiscard]] inline FusedCounts runFusedSimulation(State state,
+        std::uint64_t roundCount) noexcept {
+    FusedCounts maxCounts {};
+
+    forEachWorker(state, roundCount,
+            [&](State& generator, std::uint64_t begin, std::uint64_t end) {
+        FusedCounts local {};
+        for(std::uint64_t i {begin}; i < end; ++i) {
+            FusedCounts counts {calculateFusedRound(deriveNewState(generator),
+                    std::make_index_sequence<fusedCount>{})};
+            for(std::size_t p {0}; p < fusedCount; ++p)
+                local[p] = std::max(local[p], counts[p]);
+        }
+
+        # pragma omp critical
+        for(std::size_t p {0}; p < fusedCount; ++p)
+            maxCounts[p] = std::max(maxCounts[p], local[p]);
+    });
+
+    return maxCounts;
+}
+
+template<std::size_t... I>
+[[nodiscard]] FusedCounts runSeparateSimulations(State state,
+        std::uint64_t roundCount, std::index_sequence<I...>) noexcept {
+    return FusedCounts {runSimulation(state, roundCount,
+            Probability<fusedBits[I]>::calculateRound)...};
+}
+
+/*
+ * Runs 'attempts' attempts with chances of 1/2, 1/4, 1/8 and 1/16 per round on
+ * the same outputs, once fused and once as separate simulations.
+ */
+inline int runFusedMode(const Options& options, State seed) {
+    std::uint64_t roundCount {options.getUnsigned("rounds", rounds)};
+
+    Stopwatch fused;
+    FusedCounts fusedMax {runFusedSimulation(seed, roundCount)};
+    double fusedSeconds {fused.seconds()};
+
+    Stopwatch separate;
+    FusedCounts separateMax {runSeparateSimulations(seed, roundCount,
+            std::make_index_sequence<fusedCount>{})};
+    double separateSeconds {separate.seconds()};
+
+    bool ok {true};
+    for(std::size_t p {0}; p < fusedCount; ++p) {
+        std::cerr << "Chance 1/" << (1 << fusedBits[p]) << ": max "
+            << fusedMax[p] << " hits" << std::endl;
+        ok &= fusedMax[p] == separateMax[p];
+    }
+
+    std::cerr << "Fused: " << static_cast<std::uint64_t>(roundCount / fusedSeconds)
+        << " rounds/s, separate: "
+        << static_cast<std::uint64_t>(roundCount / separateSeconds)
+        << " rounds/s, speedup " << separateSeconds / fusedSeconds << std::endl;
+
+    if(!ok) {
+        std::cerr << "The fused and separate maxima differ" << std::endl;
+        return 1;
+    }
+    return 0;
+}
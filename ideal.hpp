@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <omp.h>
+
+#include "binomial.hpp"
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+#include "xoshiro.hpp"
+
+static inline constexpr std::uint64_t defaultIdealRuns {10'000};
+
+/*
+ * Draws the hits of an ideal round from one 64-bit uniform number by inverting
+ * the distribution function: the result is the smallest k with u < 2^64 F(k).
+ * A guide table indexed by the top byte of u starts the search right below
+ * the answer, so a draw takes a lookup and one or two comparisons.
+ */
+class BinomialSampler {
+    static inline constexpr int guideBits {8};
+
+    std::array<std::uint64_t, attempts + 1> thresholds;
+    std::array<Int, (1 << guideBits) + 1> guide;
+
+public:
+    explicit BinomialSampler(const Binomial& binomial) noexcept {
+        for(Int k = 0; k < attempts; ++k) {
+            long double tail {std::ldexp(binomial.atLeast(k + 1), 64)};
+            thresholds[k] = tail < 1 ? std::numeric_limits<std::uint64_t>::max()
+                : std::uint64_t{0} - static_cast<std::uint64_t>(std::ceil(tail));
+        }
+        thresholds[attempts] = std::numeric_limits<std::uint64_t>::max();
+
+        Int k {0};
+        for(std::uint64_t b {0}; b < guide.size(); ++b) {
+            std::uint64_t start {b << (64 - guideBits)};
+            if(b == (std::uint64_t{1} << guideBits))
+                start = std::numeric_limits<std::uint64_t>::max();
+            while(k < attempts && thresholds[k] <= start)
+                ++k;
+            guide[b] = k;
+        }
+    }
+
+    [[nodiscard]] Int operator()(std::uint64_t u) const noexcept {
+        Int k {guide[u >> (64 - guideBits)]};
+        while(k < attempts && u >= thresholds[k])
+            ++k;
+        return k;
+    }
+};
+
+/*
+ * Draws the maximum of 'rounds' ideal rounds directly: P(max <= k) = F(k)^R,
+ * so the maximum is the smallest k with R log F(k) >= log U.
+ */
+class MaxSampler {
+    std::array<double, attempts + 1> logAtMost;
+
+public:
+    MaxSampler(const Binomial& binomial, long double rounds) noexcept {
+        for(Int k = 0; k <= attempts; ++k)
+            logAtMost[k] = static_cast<double>(rounds * std::log1p(-binomial.atLeast(k + 1)));
+    }
+
+    [[nodiscard]] Int operator()(double u) const noexcept {
+        double logU {std::log1p(-u)};
+        return static_cast<Int>(std::lower_bound(logAtMost.begin(), logAtMost.end(), logU)
+                - logAtMost.begin());
+    }
+};
+
+[[nodiscard]] inline std::uint64_t idealSeed(State seed) noexcept {
+    return static_cast<std::uint64_t>(seed.u) << 32 | seed.v;
+}
+
+/*
+ * 'roundCount' ideal rounds, each drawn from one xoshiro output instead of 16
+ * outputs of the challenge generator. Every thread jumps to its own stream.
+ */
+[[nodiscard]] inline Int runIdealSimulation(State seed, std::uint64_t roundCount,
+        const BinomialSampler& sampler) noexcept {
+    Int maxCount {0};
+
+    # pragma omp parallel reduction(max:maxCount)
+    {
+        Xoshiro256 generator {idealSeed(seed)};
+        for(int i {0}; i < omp_get_thread_num(); ++i)
+            generator.jump();
+
+        # pragma omp for schedule(static)
+        for(std::uint64_t i = 0; i < roundCount; ++i)
+            maxCount = std::max(maxCount, sampler(generator()));
+    }
+
+    return maxCount;
+}
+
+/*
+ * An idealised baseline: 'rounds=' rounds drawn round by round, then 'runs='
+ * whole runs of that many rounds drawn as one maximum each, compared with the
+ * exact distribution of the maximum.
+ */
+inline int runIdealMode(const Options& options, State seed) {
+    std::uint64_t roundCount {options.getUnsigned("rounds", rounds)};
+    std::uint64_t runs {options.getUnsigned("runs", defaultIdealRuns)};
+    long double r {static_cast<long double>(roundCount)};
+    Binomial binomial;
+
+    BinomialSampler sampler {binomial};
+    Stopwatch direct;
+    Int maxHits {runIdealSimulation(seed, roundCount, sampler)};
+    double directSeconds {direct.seconds()};
+    std::cerr << "Ideal rounds: max " << maxHits << " hits, "
+        << static_cast<std::uint64_t>(roundCount / directSeconds) << " rounds/s"
+        << std::endl;
+
+    MaxSampler maxSampler {binomial, r};
+    Xoshiro256 generator {idealSeed(seed) ^ 0x5bd1e995};
+    std::map<Int, std::uint64_t> histogram;
+    Stopwatch virtualRuns;
+    for(std::uint64_t i {0}; i < runs; ++i)
+        ++histogram[maxSampler(generator.uniform())];
+    double virtualSeconds {virtualRuns.seconds()};
+
+    std::cerr << runs << " virtual runs of " << roundCount << " rounds in "
+        << virtualSeconds << " s:" << std::endl;
+    std::cerr << "  max  sampled  exact" << std::endl;
+    for(auto [k, n] : histogram)
+        std::cerr << "  " << std::setw(3) << k << "  " << std::setw(7)
+            << static_cast<double>(n) / runs << "  "
+            << binomial.maxAtLeast(k, r) - binomial.maxAtLeast(k + 1, r) << std::endl;
+    return 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+
+#include "rng.hpp"
+
+/*
+ * A multiply-with-carry half x = carry * 2^16 + output steps to
+ * multiplier * output + carry, which is x * 2^-16 modulo
+ * m = multiplier * 2^16 - 1. Once x is at most m it stays there, and only 0 and
+ * m (both fixed points) share a residue, so 'steps' steps are a single modular
+ * multiplication by 2^(-16 * steps).
+ */
+[[nodiscard]] inline constexpr Int jumpHalf(Int x, Int multiplier,
+        std::uint64_t steps) noexcept {
+    std::uint64_t modulus {(static_cast<std::uint64_t>(multiplier) << halfBitSize) - 1};
+
+    // Seeds above m need a few ordinary steps first.
+    for(; steps != 0 && x > modulus; --steps)
+        x = nextHalf(x, multiplier);
+    if(steps == 0 || x == 0 || x == modulus)
+        return x;
+
+    // 2^-16 modulo m is the multiplier itself, since multiplier * 2^16 = m + 1.
+    std::uint64_t factor {1};
+    std::uint64_t base {multiplier};
+    for(; steps != 0; steps >>= 1) {
+        if(steps & 1)
+            factor = factor * base % modulus;
+        base = base * base % modulus;
+    }
+
+    return static_cast<Int>(x * factor % modulus);
+}
+
+/*
+ * The state after 'steps' calls of nextRandomNumber.
+ */
+[[nodiscard]] inline constexpr State jumpAhead(State state, std::uint64_t steps)
+        noexcept {
+    return State {.u = jumpHalf(state.u, uMultiplier, steps),
+                  .v = jumpHalf(state.v, vMultiplier, steps)};
+}
+
+static_assert([] {
+    State stepped {.u = 0xc0de15af, .v = ~0xc0de15afu};
+    for(int i {0}; i < 1000; ++i)
+        static_cast<void>(nextRandomNumber(stepped));
+    State jumped {jumpAhead(State{.u = 0xc0de15af, .v = ~0xc0de15afu}, 1000)};
+    return stepped.u == jumped.u && stepped.v == jumped.v;
+}(), "jumpAhead disagrees with nextRandomNumber");
@@ -0,0 +1,58 @@
+#pragma once
+
+/*
+ * The ABI of round kernels loaded at run time (see plugin.hpp). It is plain C
+ * so kernels can be written in any language and built with any compiler.
+ * Within a major version RandomParallelKernel only ever grows at the end, and
+ * a kernel says in 'structSize' how much of it it was built with: the loader
+ * accepts any kernel of its major version that has at least the fields of
+ * version 2, treats fields beyond 'structSize' as zero and ignores fields it
+ * does not know. A kernel built for another major version is refused.
+ *
+ * A shared object exports
+ *
+ *     const RandomParallelKernel* random_parallel_kernel(void);
+ *
+ * returning a kernel that lives as long as the object is loaded.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RANDOM_PARALLEL_KERNEL_ABI 2
+#define RANDOM_PARALLEL_KERNEL_SYMBOL "random_parallel_kernel"
+
+enum {
+    /* 'evaluate' may be called from several threads at once. */
+    RANDOM_PARALLEL_THREAD_SAFE = 1u << 0,
+    /* The counts are those of calculateRound, so any difference is a bug. */
+    RANDOM_PARALLEL_EXACT = 1u << 1,
+};
+
+typedef struct RandomParallelKernel {
+    /* The major version, RANDOM_PARALLEL_KERNEL_ABI. */
+    uint32_t abiVersion;
+    /* sizeof(RandomParallelKernel) as the kernel was built. */
+    uint32_t structSize;
+    uint32_t capabilities;
+    const char* name;
+    /* Preferred number of rounds per call, 0 if the kernel does not care. */
+    uint64_t blockSize;
+    /*
+     * Scores 'count' rounds: 'counts[i]' becomes the number of hits of the
+     * round with the state 'u[i]', 'v[i]', as calculateRound defines a round.
+     * Returns 0 on success.
+     */
+    int (*evaluate)(void* context, const uint32_t* u, const uint32_t* v,
+            uint32_t* counts, uint64_t count);
+    void* context;
+} RandomParallelKernel;
+
+typedef const RandomParallelKernel* (*RandomParallelKernelEntry)(void);
+
+#ifdef __cplusplus
+}
+#endif
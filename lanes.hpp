@@ -0,0 +1,223 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+#include "verifier.hpp"
+
+static inline constexpr std::uint64_t defaultSeedCount {64};
+static inline constexpr std::uint64_t defaultSeedRounds {1'000'000};
+
+/*
+ * Independent generators side by side in GCC vector types: eight in an AVX2
+ * register when compiled for it, four in an SSE or NEON register otherwise.
+ * The multiply-with-carry step and the pair counting are the same as in
+ * rng.hpp, lane by lane; the popcount is done in SWAR fashion since SSE and
+ * AVX2 have none.
+ */
+#if defined(__AVX2__)
+static inline constexpr std::size_t laneCount {8};
+#else
+static inline constexpr std::size_t laneCount {4};
+#endif
+using Lanes = Int __attribute__((vector_size(laneCount * sizeof(Int))));
+
+struct LaneState {
+    Lanes u;
+    Lanes v;
+};
+
+[[nodiscard]] inline Lanes nextRandomLanes(LaneState& state) noexcept {
+    state.v = vMultiplier * (state.v & lowerHalfBitMask) + (state.v >> halfBitSize);
+    state.u = uMultiplier * (state.u & lowerHalfBitMask) + (state.u >> halfBitSize);
+    return (state.v << halfBitSize) | (state.u & lowerHalfBitMask);
+}
+
+[[nodiscard]] inline LaneState deriveNewLanes(LaneState& state) noexcept {
+    Lanes u {nextRandomLanes(state)};
+    Lanes v {nextRandomLanes(state)};
+    return LaneState {.u = u, .v = v};
+}
+
+[[nodiscard]] inline Lanes countPairHitsLanes(Lanes n) noexcept {
+    // One bit per pair, at the odd positions; shifted down, every 2-bit field
+    // holds its own count.
+    Lanes x {(n & (n << 1) & alternatingBitmask) >> 1};
+    x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+    x = (x + (x >> 4)) & 0x0f0f0f0f;
+    x += x >> 8;
+    x += x >> 16;
+    return x & 0x3f;
+}
+
+[[nodiscard]] inline Lanes calculateRoundLanes(LaneState state) noexcept {
+    Lanes count {};
+    for(Int i = 0; i < completeAttempts; ++i)
+        count += countPairHitsLanes(nextRandomLanes(state));
+    return count + countPairHitsLanes(nextRandomLanes(state) & remainingAttemptsBitmask);
+}
+
+[[nodiscard]] inline Lanes maxLanes(Lanes a, Lanes b) noexcept {
+    return a > b ? a : b;
+}
+
+[[nodiscard]] inline Int reduceMax(Lanes lanes) noexcept {
+    Int maxCount {0};
+    for(std::size_t j {0}; j < laneCount; ++j)
+        maxCount = std::max(maxCount, lanes[j]);
+    return maxCount;
+}
+
+/*
+ * A lane per round: runSimulation with every thread deriving 'laneCount' round
+ * states one after another and scoring them at once. The states still come
+ * from the serial deriveNewState chain. With a 'verifier', a sample of the
+ * rounds is checked against calculateRound and the run stops at a mismatch.
+ */
+[[nodiscard]] inline Int runRoundLanes(State seed, std::uint64_t roundCount,
+        RoundVerifier* verifier = nullptr) {
+    Int maxCount {0};
+
+    forEachWorker(seed, roundCount,
+            [&](State& generator, std::uint64_t begin, std::uint64_t end) {
+        Lanes localMax {};
+        std::uint64_t i {begin};
+        for(; i + laneCount <= end; i += laneCount) {
+            LaneState states;
+            for(std::size_t j {0}; j < laneCount; ++j) {
+                State state {deriveNewState(generator)};
+                states.u[j] = state.u;
+                states.v[j] = state.v;
+            }
+            Lanes counts {calculateRoundLanes(states)};
+            localMax = maxLanes(localMax, counts);
+            if(verifier != nullptr) {
+                for(std::size_t j {0}; j < laneCount; ++j)
+                    verifier->verify(State {.u = states.u[j], .v = states.v[j]}, counts[j]);
+                if(verifier->failed())
+                    break;
+            }
+        }
+
+        Int threadMax {reduceMax(localMax)};
+        if(verifier == nullptr || !verifier->failed())
+            for(; i < end; ++i)
+                threadMax = std::max(threadMax, calculateRound(deriveNewState(generator)));
+
+        # pragma omp critical
+        maxCount = std::max(maxCount, threadMax);
+    });
+
+    return maxCount;
+}
+
+/*
+ * A lane per stream: the experiments of all seeds are cut into the streams
+ * runSimulation would give its 'threads' threads, and every lane follows a
+ * stream of its own, so no lane waits for another's deriveNewState chain.
+ * Lanes whose stream is shorter than the longest of their group are masked
+ * out at the end. Returns the maximum of every seed, the same as
+ * runSimulation on 'threads' threads.
+ */
+[[nodiscard]] inline std::vector<Int> runSeedLanes(const std::vector<State>& seeds,
+        std::uint64_t roundCount, std::uint64_t threads) {
+    std::vector<WorkerRange> streams;
+    for(State seed : seeds)
+        for(std::uint64_t t {0}; t < threads; ++t)
+            streams.push_back(workerRange(seed, roundCount, t, threads));
+    std::vector<Int> streamMax(streams.size());
+
+    std::size_t groups {(streams.size() + laneCount - 1) / laneCount};
+    # pragma omp parallel for schedule(dynamic)
+    for(std::size_t g = 0; g < groups; ++g) {
+        LaneState generator {};
+        Lanes length {};
+        std::uint64_t longest {0};
+        for(std::size_t j {0}; j < laneCount; ++j) {
+            std::size_t s {g * laneCount + j};
+            if(s >= streams.size())
+                break;
+            generator.u[j] = streams[s].state.u;
+            generator.v[j] = streams[s].state.v;
+            length[j] = static_cast<Int>(streams[s].end - streams[s].begin);
+            longest = std::max(longest, streams[s].end - streams[s].begin);
+        }
+
+        Lanes localMax {};
+        Lanes index {};
+        for(std::uint64_t i {0}; i < longest; ++i) {
+            Lanes count {calculateRoundLanes(deriveNewLanes(generator))};
+            // All ones in the lanes still inside their stream.
+            Lanes active = reinterpret_cast<Lanes>(index < length);
+            localMax = maxLanes(localMax, count & active);
+            index += 1;
+        }
+
+        for(std::size_t j {0}; j < laneCount && g * laneCount + j < streams.size(); ++j)
+            streamMax[g * laneCount + j] = localMax[j];
+    }
+
+    std::vector<Int> maxima(seeds.size());
+    for(std::size_t s {0}; s < streams.size(); ++s)
+        maxima[s / threads] = std::max(maxima[s / threads], streamMax[s]);
+    return maxima;
+}
+
+/*
+ * Runs 'seeds=' experiments of 'rounds=' rounds each, with seeds u, u + 1, ...
+ * and the same v, three ways: seed-parallel lanes, one seed after another
+ * with a lane per round, and one seed after another with runSimulation. Prints
+ * every seed's maximum as CSV and the speed of each engine.
+ */
+inline int runSeedsMode(const Options& options, State seed) {
+    std::uint64_t seedCount {options.getUnsigned("seeds", defaultSeedCount)};
+    std::uint64_t roundCount {options.getUnsigned("rounds", defaultSeedRounds)};
+    std::uint64_t threads {static_cast<std::uint64_t>(omp_get_max_threads())};
+    // The first threads get one round more when the rounds do not split evenly.
+    if(roundCount / threads + (roundCount % threads != 0) >= (std::uint64_t{1} << 32))
+        throw std::invalid_argument {"rounds per thread must fit into 32 bits"};
+
+    std::vector<State> seeds;
+    for(std::uint64_t i {0}; i < seedCount; ++i)
+        seeds.push_back({.u = seed.u + static_cast<Int>(i), .v = seed.v});
+    double totalRounds {static_cast<double>(seedCount * roundCount)};
+
+    Stopwatch seedLanes;
+    std::vector<Int> maxima {runSeedLanes(seeds, roundCount, threads)};
+    double seedLanesSeconds {seedLanes.seconds()};
+
+    Stopwatch roundLanes;
+    std::vector<Int> roundLanesMaxima;
+    for(State s : seeds)
+        roundLanesMaxima.push_back(runRoundLanes(s, roundCount));
+    double roundLanesSeconds {roundLanes.seconds()};
+
+    Stopwatch scalar;
+    std::vector<Int> scalarMaxima;
+    for(State s : seeds)
+        scalarMaxima.push_back(runSimulation(s, roundCount, calculateRound));
+    double scalarSeconds {scalar.seconds()};
+
+    std::cout << "u,v,max" << std::endl;
+    for(std::size_t i {0}; i < seeds.size(); ++i)
+        std::cout << seeds[i].u << "," << seeds[i].v << "," << maxima[i] << std::endl;
+
+    std::cerr << "Lane per seed: " << static_cast<std::uint64_t>(totalRounds / seedLanesSeconds)
+        << " rounds/s, lane per round: "
+        << static_cast<std::uint64_t>(totalRounds / roundLanesSeconds)
+        << " rounds/s, scalar: " << static_cast<std::uint64_t>(totalRounds / scalarSeconds)
+        << " rounds/s" << std::endl;
+
+    if(maxima != roundLanesMaxima || maxima != scalarMaxima) {
+        std::cerr << "The engines disagree" << std::endl;
+        return 1;
+    }
+    return 0;
+}
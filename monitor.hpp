@@ -0,0 +1,320 @@
+#pragma once
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <omp.h>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "counters.hpp"
+#include "external.hpp"
+#include "frequency.hpp"
+#include "options.hpp"
+#include "rng.hpp"
+#include "score_table.hpp"
+#include "shared_table.hpp"
+#include "simulation.hpp"
+
+static inline constexpr Int histogramBuckets[] {60, 70, 75, 80, 85, 90, 95, 100, 105, 110, 120};
+
+/*
+ * The counters in the Prometheus text format. Rates are taken between this
+ * snapshot and the previous one.
+ */
+[[nodiscard]] inline std::string renderMetrics(const CounterSnapshot& now,
+        const CounterSnapshot& before, std::uint64_t targetRounds,
+        const std::string& engine) {
+    std::ostringstream out;
+    double interval {std::max(now.seconds - before.seconds, 1e-9)};
+
+    out << "# HELP random_parallel_rounds_completed_total Rounds evaluated so far.\n"
+        << "# TYPE random_parallel_rounds_completed_total counter\n"
+        << "random_parallel_rounds_completed_total " << now.totalRounds() << "\n"
+        << "# HELP random_parallel_rounds_target Rounds of the whole run.\n"
+        << "# TYPE random_parallel_rounds_target gauge\n"
+        << "random_parallel_rounds_target " << targetRounds << "\n"
+        << "# HELP random_parallel_worker_rounds_per_second Rounds per second of each worker.\n"
+        << "# TYPE random_parallel_worker_rounds_per_second gauge\n";
+    for(std::size_t w {0}; w < now.rounds.size(); ++w) {
+        std::uint64_t previous {w < before.rounds.size() ? before.rounds[w] : 0};
+        out << "random_parallel_worker_rounds_per_second{worker=\"" << w << "\"} "
+            << static_cast<double>(now.rounds[w] - previous) / interval << "\n";
+    }
+
+    out << "# HELP random_parallel_max_hits Highest number of hits in any round so far.\n"
+        << "# TYPE random_parallel_max_hits gauge\n"
+        << "random_parallel_max_hits " << now.maxCount << "\n"
+        << "# HELP random_parallel_round_hits Hits per round.\n"
+        << "# TYPE random_parallel_round_hits histogram\n";
+    std::uint64_t cumulative {0};
+    std::uint64_t sum {0};
+    Int k {0};
+    for(Int bucket : histogramBuckets) {
+        for(; k <= bucket; ++k)
+            cumulative += now.histogram[k];
+        out << "random_parallel_round_hits_bucket{le=\"" << bucket << "\"} " << cumulative << "\n";
+    }
+    for(Int j = 0; j <= attempts; ++j)
+        sum += j * now.histogram[j];
+    out << "random_parallel_round_hits_bucket{le=\"+Inf\"} " << now.totalRounds() << "\n"
+        << "random_parallel_round_hits_sum " << sum << "\n"
+        << "random_parallel_round_hits_count " << now.totalRounds() << "\n"
+        << "# HELP random_parallel_elapsed_seconds Time since the run started.\n"
+        << "# TYPE random_parallel_elapsed_seconds gauge\n"
+        << "random_parallel_elapsed_seconds " << now.seconds << "\n"
+        << "# HELP random_parallel_engine_info Engine scoring the rounds.\n"
+        << "# TYPE random_parallel_engine_info gauge\n"
+        << "random_parallel_engine_info{engine=\"" << engine << "\"} 1\n";
+    return out.str();
+}
+
+/*
+ * The clock, temperature and throttling gauges, for what the host exposes.
+ * 'interval' is the clock between two snapshots, 'total' the throttling
+ * since the run started.
+ */
+[[nodiscard]] inline std::string renderEnvironmentMetrics(const EnvironmentReport& interval,
+        const EnvironmentReport& total) {
+    std::ostringstream out;
+    if(interval.hasFrequency)
+        out << "# HELP random_parallel_cpu_ghz Average CPU clock since the last sample.\n"
+            << "# TYPE random_parallel_cpu_ghz gauge\n"
+            << "random_parallel_cpu_ghz " << interval.ghz << "\n";
+    if(total.hasTemperature)
+        out << "# HELP random_parallel_cpu_temperature_celsius Highest temperature so far.\n"
+            << "# TYPE random_parallel_cpu_temperature_celsius gauge\n"
+            << "random_parallel_cpu_temperature_celsius " << total.maxCelsius << "\n";
+    if(total.hasThrottling)
+        out << "# HELP random_parallel_throttled_seconds_total Time the CPUs were throttled.\n"
+            << "# TYPE random_parallel_throttled_seconds_total counter\n"
+            << "random_parallel_throttled_seconds_total " << total.throttledSeconds << "\n";
+    return out.str();
+}
+
+/*
+ * The age of the checkpoint file at 'path', if there is one.
+ */
+[[nodiscard]] inline std::string renderCheckpointMetrics(const std::string& path) {
+    std::error_code error;
+    auto written {std::filesystem::last_write_time(path, error)};
+    if(error)
+        return {};
+    double age {std::chrono::duration<double>(
+            std::filesystem::file_time_type::clock::now() - written).count()};
+    std::ostringstream out;
+    out << "# HELP random_parallel_checkpoint_age_seconds Time since the checkpoint was last written.\n"
+        << "# TYPE random_parallel_checkpoint_age_seconds gauge\n"
+        << "random_parallel_checkpoint_age_seconds " << std::max(age, 0.0) << "\n";
+    return out.str();
+}
+
+/*
+ * Snapshots 'counters' every 'interval' seconds on a thread of its own and
+ * publishes them as a textfile (written aside and renamed, so readers never
+ * see half of it), on http://127.0.0.1:<port>/metrics and as a progress line
+ * on stderr, each if asked for. The workers never wait for it.
+ */
+class MetricsExporter {
+    const RunCounters& counters;
+    std::uint64_t targetRounds;
+    std::string engine;
+    std::string file;
+    std::string checkpoint;
+    double interval;
+    bool progress;
+
+    std::mutex mutex;
+    std::condition_variable stopped;
+    bool stopping {false};
+    std::string metrics;
+
+    EnvironmentMonitor environment;
+    EnvironmentTotals environmentStart {environment.snapshot()};
+
+    FileDescriptor listener {-1};
+    std::thread sampler;
+    std::thread server;
+
+    void writeFile(const std::string& text) const {
+        std::string temporary {file + ".tmp"};
+        {
+            std::ofstream out {temporary, std::ios::trunc};
+            out << text;
+            if(!out)
+                return;
+        }
+        std::rename(temporary.c_str(), file.c_str());
+    }
+
+    void sample() {
+        CounterSnapshot before {counters.snapshot()};
+        EnvironmentTotals environmentBefore {environment.snapshot()};
+        std::unique_lock lock {mutex};
+        while(true) {
+            bool last {stopped.wait_for(lock, std::chrono::duration<double>(interval),
+                    [&] { return stopping; })};
+            lock.unlock();
+
+            CounterSnapshot now {counters.snapshot()};
+            EnvironmentTotals environmentNow {environment.snapshot()};
+            EnvironmentReport clock {environment.report(environmentBefore, environmentNow)};
+            std::string text {renderMetrics(now, before, targetRounds, engine)
+                + renderEnvironmentMetrics(clock, environment.report(environmentStart, environmentNow))};
+            if(!checkpoint.empty())
+                text += renderCheckpointMetrics(checkpoint);
+            if(!file.empty())
+                writeFile(text);
+            if(progress) {
+                std::cerr << now.totalRounds() << "/" << targetRounds << " rounds, "
+                    << static_cast<std::uint64_t>((now.totalRounds() - before.totalRounds())
+                            / std::max(now.seconds - before.seconds, 1e-9))
+                    << " rounds/s, max " << now.maxCount;
+                if(clock.hasFrequency)
+                    std::cerr << ", " << std::fixed << std::setprecision(2) << clock.ghz
+                        << " GHz" << std::defaultfloat << std::setprecision(6);
+                std::cerr << std::endl;
+            }
+            before = std::move(now);
+            environmentBefore = environmentNow;
+
+            lock.lock();
+            metrics = std::move(text);
+            if(last)
+                return;
+        }
+    }
+
+    void serve() {
+        while(true) {
+            {
+                std::lock_guard lock {mutex};
+                if(stopping)
+                    return;
+            }
+            pollfd fd {.fd = listener.get(), .events = POLLIN, .revents = 0};
+            if(poll(&fd, 1, 200) <= 0)
+                continue;
+            FileDescriptor client {accept(listener.get(), nullptr, nullptr)};
+            if(client.get() < 0)
+                continue;
+
+            // The request itself does not matter; every path gets the metrics.
+            pollfd request {.fd = client.get(), .events = POLLIN, .revents = 0};
+            char buffer[1024];
+            if(poll(&request, 1, 100) > 0)
+                static_cast<void>(recv(client.get(), buffer, sizeof(buffer), MSG_DONTWAIT));
+
+            std::string body;
+            {
+                std::lock_guard lock {mutex};
+                body = metrics;
+            }
+            std::string response {"HTTP/1.0 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body};
+            static_cast<void>(send(client.get(), response.data(), response.size(), MSG_NOSIGNAL));
+        }
+    }
+
+public:
+    MetricsExporter(const RunCounters& c, std::uint64_t target, std::string engineName,
+            const Options& options)
+        : counters{c}, targetRounds{target}, engine{std::move(engineName)},
+          file{options.getString("metrics-file", "")},
+          checkpoint{options.getString("checkpoint", "")},
+          interval{options.getDouble("interval", 1)},
+          progress{options.getUnsigned("progress", 0) != 0} {
+        if(interval <= 0)
+            throw std::invalid_argument {"interval must be positive"};
+        metrics = renderMetrics(counters.snapshot(), {}, targetRounds, engine);
+
+        std::uint64_t port {options.getUnsigned("metrics-port", 0)};
+        if(port != 0) {
+            if(port > 65535)
+                throw std::invalid_argument {"metrics-port must be below 65536"};
+            listener = FileDescriptor {socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+            if(listener.get() < 0)
+                throwSystemError("socket");
+            int reuse {1};
+            setsockopt(listener.get(), SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            sockaddr_in address {};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(static_cast<std::uint16_t>(port));
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if(bind(listener.get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+                throwSystemError("metrics-port " + std::to_string(port));
+            if(listen(listener.get(), 16) != 0)
+                throwSystemError("listen");
+            server = std::thread {[this] { serve(); }};
+        }
+        sampler = std::thread {[this] { sample(); }};
+    }
+
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+    // Publishes the final counters once more before returning.
+    ~MetricsExporter() {
+        {
+            std::lock_guard lock {mutex};
+            stopping = true;
+        }
+        stopped.notify_all();
+        sampler.join();
+        if(server.joinable())
+            server.join();
+    }
+};
+
+/*
+ * The plain simulation of 'rounds=' rounds, scored by 'engine=' (compute or a
+ * score table format, mapped from 'table-file=' if given), exporting its
+ * counters while it runs: to 'metrics-file=', on 'metrics-port=' and, with
+ * 'progress=1', to stderr, every 'interval=' seconds. With 'checkpoint=' the
+ * age of that file is exported too. 'verify=' checks that share of the rounds
+ * against calculateRound.
+ */
+inline int runMonitorMode(const Options& options, State seed) {
+    std::uint64_t roundCount {options.getUnsigned("rounds", rounds)};
+    std::string engine {options.getString("engine", "compute")};
+
+    int status {0};
+    auto run = [&](const auto& kernel) {
+        StopSignals signals;
+        RunCounters counters;
+        RoundVerifier verifier {options};
+        RunResult result;
+        {
+            MetricsExporter exporter {counters, roundCount, engine, options};
+            result = runCountedSimulation(seed, roundCount, kernel, counters, defaultTopRounds,
+                    verifier.ifEnabled());
+        }
+        verifier.finish();
+        status = finishRun(options, seed, result);
+    };
+
+    if(engine == "compute")
+        run(calculateRound);
+    else if(!visitSharedScoreTable(options, engine, run))
+        throw std::invalid_argument {"Unknown engine '" + engine + "'"};
+    return status;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+/*
+ * Command line arguments of the form '<mode> key=value key=value ...'. Modes
+ * read the keys they understand and fall back to their defaults otherwise.
+ */
+class Options {
+    std::string modeName;
+    std::map<std::string, std::string, std::less<>> values;
+
+    void add(std::string_view argument, bool first) {
+        std::size_t separator {argument.find('=')};
+        if(separator == std::string_view::npos) {
+            if(!first)
+                throw std::invalid_argument
+                    {"Expected key=value but got '" + std::string{argument} + "'"};
+            modeName = argument;
+        } else {
+            values.insert_or_assign(std::string{argument.substr(0, separator)},
+                    std::string{argument.substr(separator + 1)});
+        }
+    }
+
+public:
+    Options(int argc, char* argv[]) {
+        for(int i {1}; i < argc; ++i)
+            add(argv[i], i == 1);
+    }
+
+    /*
+     * The same from a single line separated by whitespace, as sent to the
+     * server. Values cannot contain spaces here.
+     */
+    explicit Options(std::string_view line) {
+        bool first {true};
+        while(!line.empty()) {
+            std::size_t start {line.find_first_not_of(" \t\r\n")};
+            if(start == std::string_view::npos)
+                break;
+            line.remove_prefix(start);
+            std::size_t end {std::min(line.find_first_of(" \t\r\n"), line.size())};
+            add(line.substr(0, end), first);
+            line.remove_prefix(end);
+            first = false;
+        }
+    }
+
+    [[nodiscard]] const std::string& mode() const noexcept {
+        return modeName;
+    }
+
+    [[nodiscard]] bool has(std::string_view key) const noexcept {
+        return values.find(key) != values.end();
+    }
+
+    [[nodiscard]] std::string getString(std::string_view key,
+            std::string_view fallback) const {
+        auto it {values.find(key)};
+        return it == values.end() ? std::string{fallback} : it->second;
+    }
+
+    [[nodiscard]] std::uint64_t getUnsigned(std::string_view key,
+            std::uint64_t fallback) const {
+        auto it {values.find(key)};
+        if(it == values.end())
+            return fallback;
+
+        // Accept digit separators and an 'e' exponent, e.g. 1'000'000 or 1e9.
+        std::string digits;
+        for(char c : it->second)
+            if(c != '\'' && c != '_')
+                digits.push_back(c);
+
+        auto parse = [](std::string_view text, std::uint64_t& out, int base) {
+            const char* last {text.data() + text.size()};
+            auto [end, error] {std::from_chars(text.data(), last, out, base)};
+            return !text.empty() && error == std::errc{} && end == last;
+        };
+
+        std::string_view text {digits};
+        std::uint64_t value {0};
+        std::uint64_t exponent {0};
+        std::size_t e {text.find_first_of("eE")};
+        bool ok {false};
+        if(text.starts_with("0x")) {
+            ok = parse(text.substr(2), value, 16);
+        } else if(e == std::string_view::npos) {
+            ok = parse(text, value, 10);
+        } else {
+            ok = parse(text.substr(0, e), value, 10)
+                && parse(text.substr(e + 1), exponent, 10);
+            for(std::uint64_t i {0}; ok && i < exponent; ++i)
+                value *= 10;
+        }
+
+        if(!ok)
+            throw std::invalid_argument
+                {"Invalid number '" + it->second + "' for " + std::string{key}};
+        return value;
+    }
+
+    [[nodiscard]] double getDouble(std::string_view key, double fallback) const {
+        auto it {values.find(key)};
+        if(it == values.end())
+            return fallback;
+
+        try {
+            return std::stod(it->second);
+        } catch(const std::exception&) {
+            throw std::invalid_argument
+                {"Invalid number '" + it->second + "' for " + std::string{key}};
+        }
+    }
+};
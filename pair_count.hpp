@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+
+/*
+ * countPairwiseZeroBits over whole buffers. A pair of bits never straddles a
+ * byte, so the hits of a buffer of 32-bit or 64-bit words are the hits of its
+ * bytes in any order, and every kernel below works on plain bytes: a scalar
+ * head up to the vector alignment, a vector body and a scalar tail.
+ */
+using PairCountKernel = std::uint64_t (*)(const std::uint8_t*, std::size_t) noexcept;
+
+static inline constexpr std::uint64_t alternatingBitmask64 {0xAAAAAAAAAAAAAAAA};
+
+[[nodiscard]] inline std::uint64_t countPairHitsScalar(const std::uint8_t* data,
+        std::size_t size) noexcept {
+    std::uint64_t count {0};
+    std::size_t i {0};
+    for(; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t)) {
+        std::uint64_t n;
+        std::memcpy(&n, data + i, sizeof(n));
+        count += std::popcount(n & (n << 1) & alternatingBitmask64);
+    }
+    for(; i < size; ++i)
+        count += countPairwiseZeroBits(data[i]);
+
+    return count;
+}
+
+/*
+ * Splits a buffer at 'alignment' so the body can use aligned vector loads.
+ */
+template<std::size_t alignment, typename Body>
+[[nodiscard]] std::uint64_t countPairHitsAligned(const std::uint8_t* data,
+        std::size_t size, const Body& body) noexcept {
+    std::size_t head {(alignment - reinterpret_cast<std::uintptr_t>(data) % alignment)
+        % alignment};
+    if(head >= size)
+        return countPairHitsScalar(data, size);
+
+    std::size_t bodySize {(size - head) / alignment * alignment};
+    return countPairHitsScalar(data, head) + body(data + head, bodySize)
+        + countPairHitsScalar(data + head + bodySize, size - head - bodySize);
+}
+
+#if defined(__x86_64__)
+
+/*
+ * AVX2 has no popcount, so bytes are counted with a nibble lookup (at most two
+ * hits per nibble after masking) and summed into 64-bit lanes with vpsadbw.
+ */
+__attribute__((target("avx2")))
+[[nodiscard]] inline std::uint64_t countPairHitsAvx2(const std::uint8_t* data,
+        std::size_t size) noexcept {
+    return countPairHitsAligned<32>(data, size,
+            [](const std::uint8_t* body, std::size_t bodySize)
+            __attribute__((target("avx2"))) {
+        const __m256i mask {_mm256_set1_epi8(static_cast<char>(0xAA))};
+        const __m256i nibble {_mm256_set1_epi8(0x0f)};
+        const __m256i lookup {_mm256_setr_epi8(0, 0, 1, 1, 0, 0, 1, 1,
+                1, 1, 2, 2, 1, 1, 2, 2, 0, 0, 1, 1, 0, 0, 1, 1,
+                1, 1, 2, 2, 1, 1, 2, 2)};
+        __m256i total {_mm256_setzero_si256()};
+
+        for(std::size_t i {0}; i < bodySize; i += 32) {
+            __m256i n {_mm256_load_si256(reinterpret_cast<const __m256i*>(body + i))};
+            __m256i hits {_mm256_and_si256(_mm256_and_si256(n,
+                        _mm256_add_epi8(n, n)), mask)};
+            __m256i counts {_mm256_add_epi8(
+                    _mm256_shuffle_epi8(lookup, _mm256_and_si256(hits, nibble)),
+                    _mm256_shuffle_epi8(lookup,
+                        _mm256_and_si256(_mm256_srli_epi16(hits, 4), nibble)))};
+            total = _mm256_add_epi64(total,
+                    _mm256_sad_epu8(counts, _mm256_setzero_si256()));
+        }
+
+        alignas(32) std::uint64_t lanes[4];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), total);
+        return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    });
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+[[nodiscard]] inline std::uint64_t countPairHitsAvx512(const std::uint8_t* data,
+        std::size_t size) noexcept {
+    return countPairHitsAligned<64>(data, size,
+            [](const std::uint8_t* body, std::size_t bodySize)
+            __attribute__((target("avx512f,avx512vpopcntdq"))) {
+        const __m512i mask {_mm512_set1_epi64(static_cast<long long>(alternatingBitmask64))};
+        __m512i total {_mm512_setzero_si512()};
+
+        for(std::size_t i {0}; i < bodySize; i += 64) {
+            __m512i n {_mm512_load_si512(body + i)};
+            __m512i hits {_mm512_and_si512(_mm512_and_si512(n,
+                        _mm512_add_epi64(n, n)), mask)};
+            total = _mm512_add_epi64(total, _mm512_popcnt_epi64(hits));
+        }
+
+        alignas(64) std::uint64_t lanes[8];
+        _mm512_store_si512(lanes, total);
+        return lanes[0] + lanes[1] + lanes[2] + lanes[3]
+            + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+    });
+}
+
+#elif defined(__ARM_NEON)
+
+[[nodiscard]] inline std::uint64_t countPairHitsNeon(const std::uint8_t* data,
+        std::size_t size) noexcept {
+    return countPairHitsAligned<16>(data, size,
+            [](const std::uint8_t* body, std::size_t bodySize) {
+        const uint8x16_t mask {vdupq_n_u8(0xAA)};
+        uint64x2_t total {vdupq_n_u64(0)};
+
+        for(std::size_t i {0}; i < bodySize; i += 16) {
+            uint8x16_t n {vld1q_u8(body + i)};
+            uint8x16_t hits {vandq_u8(vandq_u8(n, vshlq_n_u8(n, 1)), mask)};
+            total = vpadalq_u32(total, vpaddlq_u16(vpaddlq_u8(vcntq_u8(hits))));
+        }
+
+        return vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1);
+    });
+}
+
+#endif
+
+struct PairCountPath {
+    const char* name;
+    PairCountKernel kernel;
+};
+
+/*
+ * The kernels the host supports, fastest first. They are chosen at runtime so
+ * the binary still runs on hosts without the newer instruction sets.
+ */
+[[nodiscard]] inline std::vector<PairCountPath> pairCountPaths() {
+    std::vector<PairCountPath> paths;
+#if defined(__x86_64__)
+    if(__builtin_cpu_supports("avx512vpopcntdq"))
+        paths.push_back(PairCountPath {"avx512", countPairHitsAvx512});
+    if(__builtin_cpu_supports("avx2"))
+        paths.push_back(PairCountPath {"avx2", countPairHitsAvx2});
+#elif defined(__ARM_NEON)
+    paths.push_back(PairCountPath {"neon", countPairHitsNeon});
+#endif
+    paths.push_back(PairCountPath {"scalar", countPairHitsScalar});
+    return paths;
+}
+
+[[nodiscard]] inline const PairCountPath& pairCountPath() {
+    static const PairCountPath path {pairCountPaths().front()};
+    return path;
+}
+
+/*
+ * The number of hit pairs in a buffer, the sum of countPairwiseZeroBits over
+ * its words.
+ */
+template<typename Word>
+[[nodiscard]] std::uint64_t countPairHits(std::span<const Word> words) {
+    static_assert(sizeof(Word) == 4 || sizeof(Word) == 8);
+    return pairCountPath().kernel(reinterpret_cast<const std::uint8_t*>(words.data()),
+            words.size_bytes());
+}
+
+/*
+ * The hits of every block of 'blockWords' words (the last one may be shorter)
+ * written to 'counts', which must hold one entry per block.
+ */
+template<typename Word>
+void countPairHitsPerBlock(std::span<const Word> words, std::size_t blockWords,
+        std::span<std::uint64_t> counts) {
+    if(blockWords == 0)
+        throw std::invalid_argument {"Blocks must not be empty"};
+    std::size_t blocks {(words.size() + blockWords - 1) / blockWords};
+    if(counts.size() < blocks)
+        throw std::invalid_argument {"Not enough room for the block counts"};
+
+    for(std::size_t b {0}; b < blocks; ++b)
+        counts[b] = countPairHits(words.subspan(b * blockWords,
+                    std::min(blockWords, words.size() - b * blockWords)));
+}
+
+/*
+ * Counts the hits in 'size=' bytes of generator output with every kernel the
+ * host supports, starting at an odd address to exercise the head and tail.
+ * With 'block=' the whole buffer is also counted per block of that many words.
+ */
+inline int runPairCountMode(const Options& options, State seed) {
+    std::size_t size {options.getUnsigned("size", std::size_t{1} << 30)};
+    std::size_t words {size / sizeof(Int) + 1};
+    std::unique_ptr<Int[]> buffer {new Int[words]};
+    for(std::size_t i {0}; i < words; ++i)
+        buffer[i] = nextRandomNumber(seed);
+    const std::uint8_t* data {reinterpret_cast<const std::uint8_t*>(buffer.get()) + 1};
+
+    Stopwatch scalar;
+    std::uint64_t expected {countPairHitsScalar(data, size)};
+    double scalarSeconds {scalar.seconds()};
+    std::cerr << "reference: " << expected << " hits, "
+        << size / scalarSeconds / 1e9 << " GB/s" << std::endl;
+
+    bool ok {true};
+    for(const PairCountPath& path : pairCountPaths()) {
+        Stopwatch stopwatch;
+        std::uint64_t actual {path.kernel(data, size)};
+        double seconds {stopwatch.seconds()};
+        std::cerr << path.name << ": " << actual << " hits, "
+            << size / seconds / 1e9 << " GB/s" << std::endl;
+        ok &= actual == expected;
+    }
+
+    if(std::size_t blockWords {options.getUnsigned("block", 0)}; blockWords != 0) {
+        std::span<const Int> all {buffer.get(), words};
+        std::vector<std::uint64_t> counts((words + blockWords - 1) / blockWords);
+        countPairHitsPerBlock(all, blockWords, std::span{counts});
+        std::uint64_t sum {0};
+        for(std::uint64_t count : counts)
+            sum += count;
+        std::cerr << counts.size() << " blocks of " << blockWords << " words, "
+            << sum << " hits in total" << std::endl;
+        ok &= sum == countPairHits(all);
+    }
+
+    if(!ok) {
+        std::cerr << "The kernels disagree" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <dlfcn.h>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "kernel_abi.h"
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+#include "verifier.hpp"
+
+static inline constexpr std::uint64_t defaultKernelBlock {4096};
+static inline constexpr std::uint64_t defaultPluginRounds {100'000'000};
+static inline constexpr std::uint64_t defaultPluginCheck {1'000'000};
+
+/*
+ * calculateRound behind the plugin ABI, the reference every plugin is
+ * checked and timed against.
+ */
+inline int evaluateReference(void*, const std::uint32_t* u, const std::uint32_t* v,
+        std::uint32_t* counts, std::uint64_t count) {
+    for(std::uint64_t i {0}; i < count; ++i)
+        counts[i] = calculateRound(State {.u = u[i], .v = v[i]});
+    return 0;
+}
+
+static inline constexpr RandomParallelKernel referenceKernel {
+    .abiVersion = RANDOM_PARALLEL_KERNEL_ABI,
+    .structSize = sizeof(RandomParallelKernel),
+    .capabilities = RANDOM_PARALLEL_THREAD_SAFE | RANDOM_PARALLEL_EXACT,
+    .name = "calculateRound",
+    .blockSize = 0,
+    .evaluate = evaluateReference,
+    .context = nullptr,
+};
+
+// The fields every kernel of this major version has.
+static inline constexpr std::uint32_t minimumKernelSize {
+    offsetof(RandomParallelKernel, context) + sizeof(void*)};
+
+/*
+ * A kernel from a shared object, unloaded when destroyed. The kernel is
+ * copied as far as the plugin defines it; later fields stay zero.
+ */
+class KernelPlugin {
+    void* handle;
+    RandomParallelKernel loaded {};
+
+public:
+    explicit KernelPlugin(const std::string& path)
+        : handle{dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL)} {
+        if(handle == nullptr)
+            throw std::runtime_error {"Could not load " + path + ": " + dlerror()};
+
+        auto entry {reinterpret_cast<RandomParallelKernelEntry>(
+                dlsym(handle, RANDOM_PARALLEL_KERNEL_SYMBOL))};
+        const RandomParallelKernel* kernelPointer {entry != nullptr ? entry() : nullptr};
+        std::string error;
+        if(entry == nullptr)
+            error = path + " has no " RANDOM_PARALLEL_KERNEL_SYMBOL;
+        else if(kernelPointer == nullptr)
+            error = path + " returned no kernel";
+        else if(kernelPointer->abiVersion != RANDOM_PARALLEL_KERNEL_ABI)
+            error = path + " was built for kernel ABI "
+                + std::to_string(kernelPointer->abiVersion) + ", expected "
+                + std::to_string(RANDOM_PARALLEL_KERNEL_ABI);
+        else if(kernelPointer->structSize < minimumKernelSize)
+            error = path + " has a kernel of " + std::to_string(kernelPointer->structSize)
+                + " bytes, expected at least " + std::to_string(minimumKernelSize);
+        if(error.empty()) {
+            std::memcpy(&loaded, kernelPointer,
+                    std::min<std::size_t>(kernelPointer->structSize, sizeof(loaded)));
+            loaded.structSize = sizeof(loaded);
+            if(loaded.evaluate == nullptr)
+                error = path + " returned no kernel";
+        }
+        if(!error.empty()) {
+            dlclose(handle);
+            throw std::runtime_error {error};
+        }
+    }
+
+    KernelPlugin(const KernelPlugin&) = delete;
+    KernelPlugin& operator=(const KernelPlugin&) = delete;
+
+    ~KernelPlugin() {
+        dlclose(handle);
+    }
+
+    [[nodiscard]] const RandomParallelKernel& kernel() const noexcept {
+        return loaded;
+    }
+};
+
+[[nodiscard]] inline std::string kernelName(const RandomParallelKernel& kernel) {
+    return kernel.name != nullptr ? kernel.name : "unnamed";
+}
+
+/*
+ * Calls the kernel on 'count' rounds, one call at a time unless it is thread
+ * safe.
+ */
+inline void evaluateBlock(const RandomParallelKernel& kernel, std::mutex& serial,
+        const std::vector<std::uint32_t>& u, const std::vector<std::uint32_t>& v,
+        std::vector<std::uint32_t>& counts, std::uint64_t count) {
+    int status {0};
+    if(kernel.capabilities & RANDOM_PARALLEL_THREAD_SAFE) {
+        status = kernel.evaluate(kernel.context, u.data(), v.data(), counts.data(), count);
+    } else {
+        std::lock_guard lock {serial};
+        status = kernel.evaluate(kernel.context, u.data(), v.data(), counts.data(), count);
+    }
+    if(status != 0)
+        throw std::runtime_error {"Kernel " + kernelName(kernel) + " failed with "
+            + std::to_string(status)};
+}
+
+/*
+ * runSimulation with 'kernel' scoring the rounds: every thread derives its
+ * round states as usual and hands them over in blocks of 'block' rounds. A
+ * 'verifier' checks a sample of the rounds, as in runRoundLanes.
+ */
+[[nodiscard]] inline Int runKernelSimulation(State seed, std::uint64_t roundCount,
+        const RandomParallelKernel& kernel, std::uint64_t block,
+        RoundVerifier* verifier = nullptr) {
+    Int maxCount {0};
+    std::mutex serial;
+    std::exception_ptr error;
+
+    forEachWorker(seed, roundCount,
+            [&](State& generator, std::uint64_t begin, std::uint64_t end) {
+        std::vector<std::uint32_t> u(block), v(block), counts(block);
+        Int threadMax {0};
+        try {
+            for(std::uint64_t i {begin}; i < end; i += block) {
+                std::uint64_t count {std::min(block, end - i)};
+                for(std::uint64_t j {0}; j < count; ++j) {
+                    State state {deriveNewState(generator)};
+                    u[j] = state.u;
+                    v[j] = state.v;
+                }
+                evaluateBlock(kernel, serial, u, v, counts, count);
+                threadMax = std::max(threadMax,
+                        *std::max_element(counts.begin(), counts.begin() + count));
+                if(verifier != nullptr) {
+                    for(std::uint64_t j {0}; j < count; ++j)
+                        verifier->verify(State {.u = u[j], .v = v[j]}, counts[j]);
+                    if(verifier->failed())
+                        break;
+                }
+            }
+        } catch(...) {
+            # pragma omp critical
+            error = std::current_exception();
+        }
+
+        # pragma omp critical
+        maxCount = std::max(maxCount, threadMax);
+    });
+
+    if(error)
+        std::rethrow_exception(error);
+    return maxCount;
+}
+
+struct KernelCheck {
+    std::uint64_t rounds {0};
+    std::uint64_t mismatches {0};
+    State firstMismatch {};
+    Int expected {0};
+    Int got {0};
+};
+
+/*
+ * Compares 'kernel' with calculateRound on the first 'roundCount' round
+ * states of 'seed'.
+ */
+[[nodiscard]] inline KernelCheck checkKernel(const RandomParallelKernel& kernel, State seed,
+        std::uint64_t roundCount, std::uint64_t block) {
+    KernelCheck check {.rounds = roundCount};
+    std::mutex serial;
+    std::vector<std::uint32_t> u(block), v(block), counts(block);
+    for(std::uint64_t i {0}; i < roundCount; i += block) {
+        std::uint64_t count {std::min(block, roundCount - i)};
+        for(std::uint64_t j {0}; j < count; ++j) {
+            State state {deriveNewState(seed)};
+            u[j] = state.u;
+            v[j] = state.v;
+        }
+        evaluateBlock(kernel, serial, u, v, counts, count);
+        for(std::uint64_t j {0}; j < count; ++j) {
+            Int expected {calculateRound(State {.u = u[j], .v = v[j]})};
+            if(counts[j] == expected)
+                continue;
+            if(check.mismatches++ == 0) {
+                check.firstMismatch = State {.u = u[j], .v = v[j]};
+                check.expected = expected;
+                check.got = counts[j];
+            }
+        }
+    }
+    return check;
+}
+
+/*
+ * Loads the kernel in the shared object 'library=', checks it against the
+ * built-in calculateRound on 'check=' rounds (default 1e6) and times both on
+ * 'rounds=' rounds (default 1e8), handing over 'block=' rounds per call
+ * (default: the kernel's preference, else 4096). Without 'library=' only the
+ * built-in kernel runs. A plugin that claims to be exact fails on any
+ * difference; for others the differing rounds are only counted. 'verify='
+ * also checks that share of the rounds of an exact plugin's timed run.
+ */
+inline int runPluginMode(const Options& options, State seed) {
+    std::uint64_t roundCount {options.getUnsigned("rounds", defaultPluginRounds)};
+    std::uint64_t checkCount {options.getUnsigned("check", defaultPluginCheck)};
+    std::string library {options.getString("library", "")};
+
+    auto block = [&](const RandomParallelKernel& kernel) {
+        std::uint64_t size {options.getUnsigned("block",
+                kernel.blockSize != 0 ? kernel.blockSize : defaultKernelBlock)};
+        if(size == 0)
+            throw std::invalid_argument {"block must be positive"};
+        return size;
+    };
+    auto time = [&](const RandomParallelKernel& kernel, RoundVerifier* verifier) {
+        Stopwatch stopwatch;
+        Int maxCount {runKernelSimulation(seed, roundCount, kernel, block(kernel), verifier)};
+        double seconds {stopwatch.seconds()};
+        std::cerr << kernelName(kernel) << ": " << static_cast<std::uint64_t>(roundCount / seconds)
+            << " rounds/s, max " << maxCount << std::endl;
+        return maxCount;
+    };
+
+    if(library.empty()) {
+        static_cast<void>(time(referenceKernel, nullptr));
+        return 0;
+    }
+
+    KernelPlugin plugin {library};
+    const RandomParallelKernel& kernel {plugin.kernel()};
+    bool exact {(kernel.capabilities & RANDOM_PARALLEL_EXACT) != 0};
+    std::cerr << "Loaded " << kernelName(kernel) << " from " << library << " ("
+        << (kernel.capabilities & RANDOM_PARALLEL_THREAD_SAFE ? "thread safe" : "serialised")
+        << ", " << (exact ? "exact" : "own model") << ")" << std::endl;
+
+    KernelCheck check {checkKernel(kernel, seed, checkCount, block(kernel))};
+    std::cerr << check.mismatches << " of " << check.rounds
+        << " rounds differ from calculateRound";
+    if(check.mismatches != 0)
+        std::cerr << ", first u=" << check.firstMismatch.u << " v=" << check.firstMismatch.v
+            << ": " << check.got << " instead of " << check.expected;
+    std::cerr << std::endl;
+    if(exact && check.mismatches != 0)
+        return 1;
+
+    RoundVerifier verifier {exact ? options.getDouble("verify", 0) : 0};
+    Int referenceMax {time(referenceKernel, nullptr)};
+    Int pluginMax {time(kernel, verifier.ifEnabled())};
+    verifier.finish();
+    return exact && pluginMax != referenceMax ? 1 : 0;
+}
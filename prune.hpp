@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include "binomial.hpp"
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+
+static inline constexpr double defaultEpsilon {1e-6};
+static inline constexpr Int prunePoints {completeAttempts + 1};
+
+/*
+ * When a round is given up: after w of its outputs, with 231 - 16 w attempts
+ * left, a round that still needs d more hits has probability
+ * P(Binomial(231 - 16 w, 1/4) >= d) of getting them if the attempts were
+ * independent. 'slack[w]' is the largest d whose probability is at least
+ * epsilon, so a round with count + slack[w] < needed is given up. With
+ * epsilon = 0 only rounds that cannot make it are, which is exact.
+ */
+class PruneBounds {
+    std::array<Int, prunePoints> slackAt;
+    std::vector<double> tails;
+
+public:
+    explicit PruneBounds(double epsilon) : tails(prunePoints * (attempts + 2)) {
+        for(Int w = 0; w < prunePoints; ++w) {
+            Int left {attempts - w * numberOfExtractedPairs};
+            Binomial binomial {left};
+            slackAt[w] = 0;
+            for(Int d = 0; d <= left; ++d) {
+                tails[w * (attempts + 2) + d] = static_cast<double>(binomial.atLeast(d));
+                if(epsilon == 0 || binomial.atLeast(d) >= epsilon)
+                    slackAt[w] = d;
+            }
+        }
+    }
+
+    [[nodiscard]] Int slack(Int w) const noexcept {
+        return slackAt[w];
+    }
+
+    // The chance of a round after w outputs to still gain 'needed' hits.
+    [[nodiscard]] double tail(Int w, Int needed) const noexcept {
+        return tails[w * (attempts + 2) + std::min(needed, attempts + 1)];
+    }
+};
+
+/*
+ * calculateRound that gives up once the round is unlikely to reach 'needed'
+ * and then returns a count below 'needed'. The chance that a given-up round
+ * would have made it is added to 'missed', the outputs generated to 'outputs'.
+ */
+[[nodiscard]] inline Int calculatePrunedRound(State state, Int needed,
+        const PruneBounds& bounds, double& missed, std::uint64_t& outputs) noexcept {
+    Int count {0};
+    for(Int w = 0; w < completeAttempts; ++w) {
+        if(count + bounds.slack(w) < needed) {
+            missed += bounds.tail(w, needed - count);
+            return count;
+        }
+        count += countPairwiseZeroBits(nextRandomNumber(state));
+        ++outputs;
+    }
+
+    if(count + bounds.slack(completeAttempts) < needed) {
+        missed += bounds.tail(completeAttempts, needed - count);
+        return count;
+    }
+    ++outputs;
+    return count + countPairwiseZeroBits(nextRandomNumber(state) & remainingAttemptsBitmask);
+}
+
+struct PruneResult {
+    Int maxCount {0};
+    std::uint64_t aboveThreshold {0};
+    std::uint64_t outputs {0};
+    // The sum of the chances of the given-up rounds.
+    double missed {0};
+};
+
+/*
+ * runSimulation that gives up rounds which are unlikely to beat the running
+ * maximum of their thread, or to reach 'threshold' (0 for a plain maximum).
+ * The maximum and the number of rounds above the threshold can come out too
+ * low; by the union bound the chance that the maximum did (or the expected
+ * number of rounds above the threshold that were missed) is at most 'missed',
+ * as far as the attempts behave like independent 1/4 chances.
+ */
+[[nodiscard]] inline PruneResult runPrunedSimulation(State state,
+        std::uint64_t roundCount, const PruneBounds& bounds, Int threshold) {
+    PruneResult result;
+
+    forEachWorker(state, roundCount,
+            [&](State& generator, std::uint64_t begin, std::uint64_t end) {
+        PruneResult local;
+        for(std::uint64_t i {begin}; i < end; ++i) {
+            Int best {local.maxCount};
+            Int needed {threshold == 0 ? best + 1 : std::min(threshold, best + 1)};
+            Int count {calculatePrunedRound(deriveNewState(generator), needed, bounds,
+                    local.missed, local.outputs)};
+            local.maxCount = std::max(best, count);
+            local.aboveThreshold += threshold != 0 && count >= threshold;
+        }
+
+        # pragma omp critical
+        {
+            result.maxCount = std::max(result.maxCount, local.maxCount);
+            result.aboveThreshold += local.aboveThreshold;
+            result.outputs += local.outputs;
+            result.missed += local.missed;
+        }
+    });
+
+    return result;
+}
+
+inline void reportPruneRun(const char* name, const PruneResult& result,
+        std::uint64_t roundCount, double seconds, double plainSeconds, Int threshold) {
+    double outputs {static_cast<double>(roundCount) * (completeAttempts + 1)};
+    std::cerr << name << ": " << static_cast<std::uint64_t>(roundCount / seconds)
+        << " rounds/s, max " << result.maxCount << ", "
+        << 100.0 * (1 - result.outputs / outputs) << "% of the outputs skipped, speedup "
+        << plainSeconds / seconds << std::endl;
+    if(threshold != 0)
+        std::cerr << "  " << result.aboveThreshold << " rounds with at least " << threshold
+            << " hits, expected number missed at most " << result.missed << std::endl;
+    else
+        std::cerr << "  chance that a higher maximum was missed at most "
+            << std::min(result.missed, 1.0) << std::endl;
+}
+
+/*
+ * Compares the plain simulation with exact pruning (epsilon = 0) and with
+ * pruning that misses the maximum (or, with 'threshold=', a round above it)
+ * with a chance of at most 'epsilon=' in total.
+ */
+inline int runPruneMode(const Options& options, State seed) {
+    std::uint64_t roundCount {options.getUnsigned("rounds", rounds)};
+    double epsilon {options.getDouble("epsilon", defaultEpsilon)};
+    Int threshold {static_cast<Int>(options.getUnsigned("threshold", 0))};
+    if(epsilon < 0 || epsilon >= 1)
+        throw std::invalid_argument {"epsilon must be in [0, 1)"};
+
+    // Every given-up round adds less than epsilon / rounds to the bound.
+    PruneBounds exactBounds {0};
+    PruneBounds bounds {roundCount == 0 ? 0 : epsilon / static_cast<double>(roundCount)};
+
+    Stopwatch plain;
+    Int plainMax {runSimulation(seed, roundCount, calculateRound)};
+    double plainSeconds {plain.seconds()};
+    std::cerr << "plain: " << static_cast<std::uint64_t>(roundCount / plainSeconds)
+        << " rounds/s, max " << plainMax << std::endl;
+
+    Stopwatch exact;
+    PruneResult exactResult {runPrunedSimulation(seed, roundCount, exactBounds, threshold)};
+    reportPruneRun("exact pruning", exactResult, roundCount, exact.seconds(), plainSeconds,
+            threshold);
+
+    Stopwatch pruned;
+    PruneResult result {runPrunedSimulation(seed, roundCount, bounds, threshold)};
+    reportPruneRun("epsilon pruning", result, roundCount, pruned.seconds(), plainSeconds,
+            threshold);
+
+    if(exactResult.maxCount != plainMax) {
+        std::cerr << "Exact pruning changed the maximum" << std::endl;
+        return 1;
+    }
+    if(result.maxCount != plainMax)
+        std::cerr << "Epsilon pruning missed the maximum " << plainMax << std::endl;
+    return 0;
+}
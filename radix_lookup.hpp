@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "options.hpp"
+#include "rng.hpp"
+#include "score_table.hpp"
+#include "shared_table.hpp"
+#include "simulation.hpp"
+
+static inline constexpr std::uint64_t defaultRadixBlock {1 << 20};
+static inline constexpr unsigned defaultBucketBits {12};
+// 2^24 buckets already take 64 MiB of counts per thread.
+static inline constexpr unsigned maxBucketBits {24};
+
+/*
+ * Looks up the scores of a block of rounds in table order instead of round
+ * order. The table indices of a half are bucketed by their high bits with a
+ * counting sort, so consecutive lookups stay within a small part of the table
+ * and mostly hit pages and cache lines that are already present. A maximum
+ * needs both halves of a round, so the half scores are scattered back into a
+ * small per-block array rather than reduced straight away.
+ */
+class RadixScratch {
+    struct Entry {
+        Int index;
+        Int round;
+    };
+
+    unsigned bucketBits;
+    std::vector<std::uint32_t> counts;
+    std::vector<Entry> entries;
+    std::vector<Entry> sorted;
+
+public:
+    std::vector<State> states;
+    std::vector<std::uint8_t> scores;
+
+    RadixScratch(std::uint64_t blockSize, unsigned bits)
+        : bucketBits{bits}, counts((std::size_t{1} << bits) + 1),
+          entries(blockSize), sorted(blockSize), states(blockSize),
+          scores(blockSize) {}
+
+    template<typename HalfTable, typename Seed>
+    void lookup(const HalfTable& half, std::size_t n, const Seed& seedOf) {
+        unsigned width {static_cast<unsigned>(std::bit_width(half.entries() - 1))};
+        unsigned shift {width > bucketBits ? width - bucketBits : 0};
+
+        std::fill(counts.begin(), counts.end(), 0);
+        for(std::size_t i {0}; i < n; ++i) {
+            Int index {static_cast<Int>(half.index(seedOf(states[i])))};
+            entries[i] = Entry{.index = index, .round = static_cast<Int>(i)};
+            ++counts[(index >> shift) + 1];
+        }
+
+        for(std::size_t b {1}; b < counts.size(); ++b)
+            counts[b] += counts[b - 1];
+
+        for(std::size_t i {0}; i < n; ++i)
+            sorted[counts[entries[i].index >> shift]++] = entries[i];
+
+        for(std::size_t i {0}; i < n; ++i)
+            scores[sorted[i].round] += half.scoreAt(sorted[i].index);
+    }
+};
+
+/*
+ * The same rounds as runSimulation(state, roundCount, table), scored in blocks
+ * of 'blockSize' rounds with bucketed lookups.
+ */
+template<typename Table>
+[[nodiscard]] Int runRadixSimulation(State state, std::uint64_t roundCount,
+        const Table& table, unsigned bucketBits, std::uint64_t blockSize) {
+    Int maxCount {0};
+
+    forEachWorker(state, roundCount,
+            [&](State& generator, std::uint64_t begin, std::uint64_t end) {
+        RadixScratch scratch {blockSize, bucketBits};
+        Int localMax {0};
+
+        for(std::uint64_t first {begin}; first < end; first += blockSize) {
+            std::size_t n {static_cast<std::size_t>(std::min(blockSize, end - first))};
+            for(std::size_t i {0}; i < n; ++i)
+                scratch.states[i] = deriveNewState(generator);
+
+            std::fill_n(scratch.scores.begin(), n, 0);
+            scratch.lookup(table.u, n, [](State s) { return s.u; });
+            scratch.lookup(table.v, n, [](State s) { return s.v; });
+            localMax = std::max<Int>(localMax,
+                    *std::max_element(scratch.scores.begin(),
+                        scratch.scores.begin() + n));
+        }
+
+        # pragma omp critical
+        maxCount = std::max(maxCount, localMax);
+    });
+
+    return maxCount;
+}
+
+/*
+ * Compares bucketed lookups against lookups in round order on the same table,
+ * mapped from 'table-file=' if given.
+ */
+inline int runRadixMode(const Options& options, State seed) {
+    std::string format {options.getString("format", "reachable-packed")};
+    std::uint64_t roundCount {options.getUnsigned("rounds", rounds)};
+    std::uint64_t blockSize {options.getUnsigned("block", defaultRadixBlock)};
+    std::uint64_t bits {options.getUnsigned("bucket-bits", defaultBucketBits)};
+    // Rounds and bucket counts within a block are 32 bits, and a shift by the
+    // full width of Int would be undefined.
+    if(blockSize == 0 || blockSize >= (std::uint64_t{1} << 32))
+        throw std::invalid_argument {"block must be 1 to 2^32 - 1"};
+    if(bits < 1 || bits > maxBucketBits)
+        throw std::invalid_argument {"bucket-bits must be 1 to " + std::to_string(maxBucketBits)};
+    unsigned bucketBits {static_cast<unsigned>(bits)};
+
+    int result {0};
+    bool known {visitSharedScoreTable(options, format, [&](const auto& table) {
+        Stopwatch direct;
+        Int directMax {runSimulation(seed, roundCount, table)};
+        double directSeconds {direct.seconds()};
+
+        Stopwatch radix;
+        Int radixMax {runRadixSimulation(seed, roundCount, table, bucketBits,
+                blockSize)};
+        double radixSeconds {radix.seconds()};
+
+        std::cerr << format << " in round order: "
+            << static_cast<std::uint64_t>(roundCount / directSeconds)
+            << " rounds/s, max " << directMax << std::endl;
+        std::cerr << format << " bucketed by " << bucketBits << " bits: "
+            << static_cast<std::uint64_t>(roundCount / radixSeconds)
+            << " rounds/s, max " << radixMax << std::endl;
+
+        if(directMax != radixMax) {
+            std::cerr << "The maxima differ" << std::endl;
+            result = 1;
+        }
+    })};
+
+    if(!known)
+        throw std::invalid_argument {"Unknown table format '" + format + "'"};
+    return result;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+
+#include "binomial.hpp"
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+
+static inline constexpr long double maxQuantiles[]
+    {0.001L, 0.01L, 0.05L, 0.25L, 0.5L, 0.75L, 0.95L, 0.99L, 0.999L};
+
+/*
+ * The exact distribution of the maximum over 'rounds' independent
+ * Binomial(231, 1/4) rounds, and the p-value of an observed maximum: either
+ * 'observed=' or the one runSimulation finds.
+ */
+inline int runReferenceMode(const Options& options, State seed) {
+    std::uint64_t roundCount {options.getUnsigned("rounds", rounds)};
+    long double r {static_cast<long double>(roundCount)};
+    Binomial binomial;
+
+    std::cerr << "Maximum of " << roundCount << " ideal rounds of " << attempts
+        << " attempts: expected " << std::setprecision(6)
+        << binomial.expectedMax(r) << std::endl;
+    for(long double q : maxQuantiles)
+        std::cerr << "  " << q * 100 << "% quantile: "
+            << binomial.maxQuantile(q, r) << std::endl;
+
+    std::cerr << "  P(max = k):" << std::endl;
+    for(Int k = 0; k <= attempts; ++k) {
+        long double p {binomial.maxAtLeast(k, r) - binomial.maxAtLeast(k + 1, r)};
+        if(p >= 1e-6L)
+            std::cerr << "    " << k << ": " << p << std::endl;
+    }
+
+    Int observed {0};
+    if(options.has("observed")) {
+        observed = static_cast<Int>(options.getUnsigned("observed", 0));
+    } else {
+        observed = runSimulation(seed, roundCount, calculateRound);
+        std::cerr << "runSimulation found at max " << observed << " hits"
+            << std::endl;
+    }
+
+    std::cerr << "p-value of " << observed << ": P(max >= " << observed << ") = "
+        << binomial.maxAtLeast(observed, r) << std::endl;
+    return 0;
+}
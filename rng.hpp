@@ -0,0 +1,88 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+
+using Int=std::uint32_t;
+
+static inline constexpr std::size_t bitSize {sizeof(Int) * 8};
+static inline constexpr std::size_t halfBitSize {bitSize / 2};
+static inline constexpr Int lowerHalfBitMask {(1 << halfBitSize) - 1};
+
+struct State {
+    Int u;
+    Int v;
+};
+
+static inline constexpr Int uMultiplier {18000};
+static inline constexpr Int vMultiplier {36969};
+
+/*
+ * One multiply-with-carry step on one half of the state. The upper half of 'x'
+ * is the carry, the lower half the last output.
+ */
+[[nodiscard]] inline constexpr Int nextHalf(Int x, Int multiplier) noexcept {
+    return multiplier * (x & lowerHalfBitMask) + (x >> halfBitSize);
+}
+
+/*
+ * The peudo-random number generating function
+ */
+[[nodiscard]] inline constexpr Int nextRandomNumber(State& state) noexcept {
+    // FIXME: Only works if sizeof(Int) == 4
+    state.v = nextHalf(state.v, vMultiplier);
+    state.u = nextHalf(state.u, uMultiplier);
+    return (state.v << halfBitSize) | (state.u & lowerHalfBitMask);
+}
+
+[[nodiscard]] inline constexpr State deriveNewState(State& state) noexcept {
+    Int u { nextRandomNumber(state) };
+    Int v { nextRandomNumber(state) };
+    return State {.u = u, .v = v};
+}
+
+// FIXME: Only works if sizeof(Int) == 4
+static inline constexpr Int alternatingBitmask {0xAAAAAAAA};
+
+/*
+ * A 32-bit number has 16 pairs bits. If every bit has a 50/50 chance of being 0
+ * or 1, than the probability of a pair of bits being 11 is 1/4. Thus we can
+ * extract 16 1/4 chances from a 32-bit number.
+ */
+[[nodiscard]] inline constexpr Int countPairwiseZeroBits(Int n) noexcept {
+    return std::popcount(n & (n << 1) & alternatingBitmask);
+}
+
+
+static inline constexpr Int attempts {231};
+
+static inline constexpr Int numberOfExtractedPairs {halfBitSize};
+static inline constexpr Int completeAttempts {attempts / numberOfExtractedPairs};
+static inline constexpr Int remainingAttempts {attempts % numberOfExtractedPairs};
+static inline constexpr Int remainingAttemptsBitmask {(1 << (remainingAttempts * 2)) - 1};
+
+
+/*
+ * Counts the number of time a 1/4 change is hit when doing 'attempts' attempts.
+ */
+[[nodiscard]] inline Int calculateRound(State state) noexcept {
+    Int count {0};
+
+    // Note: Explicily requesting simd instruction decreased performance
+    // slightly on a RPI 5.
+    //#pragma omp simd
+    for(Int i = 0; i < completeAttempts; ++i) {
+        Int pseudoRandomNumber { nextRandomNumber(state) };
+        Int hits { countPairwiseZeroBits(pseudoRandomNumber) };
+        count += hits;
+    }
+
+    Int pseudoRandomNumber {nextRandomNumber(state) & remainingAttemptsBitmask};
+    Int hits = countPairwiseZeroBits(pseudoRandomNumber);
+    count += hits;
+
+    return count;
+}
+
+
+static inline constexpr Int rounds  {1'000'000'000};
@@ -0,0 +1,489 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/io_uring.h>
+#include <memory>
+#include <mutex>
+#include <omp.h>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "external.hpp"
+#include "jump.hpp"
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+
+static inline constexpr std::uint64_t defaultScoreBuffer {1 << 20};
+static inline constexpr std::uint64_t defaultScoreBuffers {16};
+static inline constexpr std::uint64_t defaultScoreChecks {1000};
+
+/*
+ * A minimal io_uring on the raw system calls, enough to queue writes and reap
+ * their completions from a single thread. The rings are shared with the
+ * kernel, so their heads and tails are read and written atomically.
+ */
+class IoUring {
+    FileDescriptor ring {-1};
+    io_uring_params params {};
+    SharedMapping submissionRing;
+    SharedMapping completionRing;
+    SharedMapping entries;
+    bool registered {false};
+
+    [[nodiscard]] std::uint32_t* submission(std::uint32_t offset) const noexcept {
+        return reinterpret_cast<std::uint32_t*>(submissionRing.data() + offset);
+    }
+
+    [[nodiscard]] std::uint32_t* completion(std::uint32_t offset) const noexcept {
+        return reinterpret_cast<std::uint32_t*>(completionRing.data() + offset);
+    }
+
+public:
+    explicit IoUring(unsigned size) {
+        ring = FileDescriptor {static_cast<int>(syscall(__NR_io_uring_setup, size, &params))};
+        if(ring.get() < 0)
+            throwSystemError("io_uring_setup");
+
+        std::uint64_t submissionBytes {params.sq_off.array + params.sq_entries * sizeof(std::uint32_t)};
+        std::uint64_t completionBytes {params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe)};
+        if(params.features & IORING_FEAT_SINGLE_MMAP)
+            submissionBytes = completionBytes = std::max(submissionBytes, completionBytes);
+        submissionRing = SharedMapping {ring.get(), submissionBytes, PROT_READ | PROT_WRITE,
+            static_cast<off_t>(IORING_OFF_SQ_RING)};
+        completionRing = params.features & IORING_FEAT_SINGLE_MMAP
+            ? SharedMapping {ring.get(), submissionBytes, PROT_READ | PROT_WRITE,
+                static_cast<off_t>(IORING_OFF_SQ_RING)}
+            : SharedMapping {ring.get(), completionBytes, PROT_READ | PROT_WRITE,
+                static_cast<off_t>(IORING_OFF_CQ_RING)};
+        entries = SharedMapping {ring.get(), params.sq_entries * sizeof(io_uring_sqe),
+            PROT_READ | PROT_WRITE, static_cast<off_t>(IORING_OFF_SQES)};
+    }
+
+    /*
+     * Registers 'buffers' with the kernel so writes from them skip the page
+     * pinning on every call. Returns false if the kernel refuses, e.g. over
+     * RLIMIT_MEMLOCK, in which case writes simply stay unregistered.
+     */
+    bool registerBuffers(const std::vector<iovec>& buffers) noexcept {
+        registered = syscall(__NR_io_uring_register, ring.get(), IORING_REGISTER_BUFFERS,
+                buffers.data(), static_cast<unsigned>(buffers.size())) == 0;
+        return registered;
+    }
+
+    [[nodiscard]] std::uint32_t capacity() const noexcept {
+        return params.sq_entries;
+    }
+
+    // Queues a write of 'length' bytes at 'offset'; the caller keeps at most capacity() queued.
+    void queueWrite(int fd, std::uint32_t buffer, const std::uint8_t* data, std::uint32_t length,
+            std::uint64_t offset, std::uint64_t userData) noexcept {
+        std::uint32_t tail {*submission(params.sq_off.tail)};
+        std::uint32_t index {tail & *submission(params.sq_off.ring_mask)};
+        io_uring_sqe& entry {reinterpret_cast<io_uring_sqe*>(entries.data())[index]};
+        std::memset(&entry, 0, sizeof(entry));
+        entry.opcode = registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        entry.fd = fd;
+        entry.addr = reinterpret_cast<std::uint64_t>(data);
+        entry.len = length;
+        entry.off = offset;
+        entry.buf_index = static_cast<std::uint16_t>(buffer);
+        entry.user_data = userData;
+        submission(params.sq_off.array)[index] = index;
+        std::atomic_ref<std::uint32_t>{*submission(params.sq_off.tail)}
+            .store(tail + 1, std::memory_order_release);
+    }
+
+    // Submits what was queued and waits until at least 'minimum' writes completed.
+    void submit(unsigned queued, unsigned minimum) {
+        while(syscall(__NR_io_uring_enter, ring.get(), queued, minimum,
+                    minimum != 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0) < 0) {
+            if(errno != EINTR)
+                throwSystemError("io_uring_enter");
+            queued = 0;
+        }
+    }
+
+    // Calls 'f(userData, result)' for every completed write.
+    template<typename F>
+    void reap(const F& f) {
+        std::atomic_ref<std::uint32_t> head {*completion(params.cq_off.head)};
+        std::uint32_t current {head.load(std::memory_order_relaxed)};
+        std::uint32_t tail {std::atomic_ref<std::uint32_t>{*completion(params.cq_off.tail)}
+            .load(std::memory_order_acquire)};
+        std::uint32_t mask {*completion(params.cq_off.ring_mask)};
+        auto* completions {reinterpret_cast<io_uring_cqe*>(completionRing.data() + params.cq_off.cqes)};
+        for(; current != tail; ++current) {
+            const io_uring_cqe& done {completions[current & mask]};
+            f(done.user_data, done.res);
+        }
+        head.store(current, std::memory_order_release);
+    }
+};
+
+/*
+ * 'length' scores of consecutive rounds from 'round' on in a pool buffer, of
+ * which 'written' are on the file already.
+ */
+struct ScoreBlock {
+    std::uint32_t buffer;
+    std::uint64_t round;
+    std::uint64_t length;
+    std::uint64_t written {0};
+};
+
+/*
+ * Writes per-round scores, one byte per round at the offset of its round,
+ * from a fixed pool of buffers. Workers take a free buffer, fill it and hand
+ * it over; a writer thread writes it with io_uring (or pwrite where io_uring
+ * is not available) and puts it back. When all buffers are in flight the
+ * workers wait, so a slow disk slows the computation instead of filling
+ * memory.
+ */
+class ScoreWriter {
+    int fd;
+    std::uint64_t bufferSize;
+    std::uint32_t bufferCount;
+    std::unique_ptr<std::uint8_t[], decltype(&std::free)> memory {nullptr, &std::free};
+    std::optional<IoUring> ring;
+    bool registeredBuffers {false};
+
+    std::mutex mutex;
+    std::condition_variable freed;
+    std::condition_variable filledUp;
+    std::vector<std::uint32_t> freeBuffers;
+    std::deque<ScoreBlock> filled;
+    bool closing {false};
+    std::uint64_t waits {0};
+    std::exception_ptr error;
+    std::atomic<bool> broken {false};
+    std::thread writer;
+
+    [[nodiscard]] std::uint8_t* data(std::uint32_t buffer) const noexcept {
+        return memory.get() + buffer * bufferSize;
+    }
+
+    // Keeps the first write error, which finish() throws.
+    void fail(std::exception_ptr e) noexcept {
+        if(!error)
+            error = std::move(e);
+        broken.store(true, std::memory_order_relaxed);
+    }
+
+    void release(std::uint32_t buffer) {
+        {
+            std::lock_guard lock {mutex};
+            freeBuffers.push_back(buffer);
+        }
+        freed.notify_one();
+    }
+
+    // Waits for filled blocks; false once there are none and none will come.
+    [[nodiscard]] bool take(std::deque<ScoreBlock>& pending, bool wait) {
+        std::unique_lock lock {mutex};
+        if(wait)
+            filledUp.wait(lock, [&] { return !filled.empty() || closing; });
+        while(!filled.empty()) {
+            pending.push_back(filled.front());
+            filled.pop_front();
+        }
+        return !closing;
+    }
+
+    void writeWithPwrite() {
+        std::deque<ScoreBlock> pending;
+        while(true) {
+            bool more {take(pending, true)};
+            if(pending.empty() && !more)
+                return;
+            for(ScoreBlock block : pending) {
+                while(block.written < block.length && !error) {
+                    ssize_t n {pwrite(fd, data(block.buffer) + block.written,
+                            block.length - block.written,
+                            static_cast<off_t>(block.round + block.written))};
+                    if(n < 0 && errno == EINTR)
+                        continue;
+                    if(n <= 0) {
+                        fail(std::make_exception_ptr(std::system_error
+                            {errno, std::generic_category(), "pwrite"}));
+                        break;
+                    }
+                    block.written += static_cast<std::uint64_t>(n);
+                }
+                release(block.buffer);
+            }
+            pending.clear();
+        }
+    }
+
+    void writeWithRing() {
+        std::deque<ScoreBlock> pending;
+        std::vector<ScoreBlock> inFlight(bufferCount);
+        std::vector<bool> busy(bufferCount);
+        std::uint32_t running {0};
+        bool more {true};
+        while(more || !pending.empty() || running != 0) {
+            more = take(pending, pending.empty() && running == 0) && more;
+
+            unsigned queued {0};
+            while(!pending.empty() && running < ring->capacity()) {
+                ScoreBlock block {pending.front()};
+                pending.pop_front();
+                if(error) {
+                    release(block.buffer);
+                    continue;
+                }
+                ring->queueWrite(fd, block.buffer, data(block.buffer) + block.written,
+                        static_cast<std::uint32_t>(block.length - block.written),
+                        block.round + block.written, block.buffer);
+                inFlight[block.buffer] = block;
+                busy[block.buffer] = true;
+                ++queued;
+                ++running;
+            }
+            try {
+                ring->submit(queued, running != 0 ? 1 : 0);
+            } catch(const std::system_error&) {
+                // Nothing will complete any more; the workers get the buffers back.
+                fail(std::current_exception());
+                for(std::uint32_t b {0}; b < bufferCount; ++b)
+                    if(busy[b])
+                        release(b);
+                busy.assign(bufferCount, false);
+                running = 0;
+                continue;
+            }
+
+            ring->reap([&](std::uint64_t buffer, std::int32_t result) {
+                --running;
+                busy[buffer] = false;
+                ScoreBlock& block {inFlight[buffer]};
+                if(result <= 0)
+                    fail(std::make_exception_ptr(std::system_error
+                        {result < 0 ? -result : EIO, std::generic_category(), "io_uring write"}));
+                if(result > 0)
+                    block.written += static_cast<std::uint64_t>(result);
+                // A short write is continued before anything else.
+                if(result > 0 && block.written < block.length)
+                    pending.push_front(block);
+                else
+                    release(block.buffer);
+            });
+        }
+    }
+
+public:
+    ScoreWriter(int descriptor, std::uint32_t buffers, std::uint64_t size, bool useRing)
+        : fd{descriptor}, bufferSize{(size + 4095) / 4096 * 4096}, bufferCount{buffers} {
+        memory.reset(static_cast<std::uint8_t*>(std::aligned_alloc(4096, bufferSize * bufferCount)));
+        if(!memory)
+            throw std::bad_alloc {};
+        for(std::uint32_t b {0}; b < bufferCount; ++b)
+            freeBuffers.push_back(b);
+
+        if(useRing) {
+            try {
+                ring.emplace(bufferCount);
+                std::vector<iovec> buffersToRegister;
+                for(std::uint32_t b {0}; b < bufferCount; ++b)
+                    buffersToRegister.push_back({.iov_base = data(b), .iov_len = bufferSize});
+                registeredBuffers = ring->registerBuffers(buffersToRegister);
+            } catch(const std::system_error& e) {
+                std::cerr << "No io_uring (" << e.what() << "), writing with pwrite" << std::endl;
+                ring.reset();
+            }
+        }
+        writer = std::thread {[this] {
+            if(ring)
+                writeWithRing();
+            else
+                writeWithPwrite();
+        }};
+    }
+
+    ScoreWriter(const ScoreWriter&) = delete;
+    ScoreWriter& operator=(const ScoreWriter&) = delete;
+
+    // A write error is only reported by finish(); here it is dropped.
+    ~ScoreWriter() {
+        if(!writer.joinable())
+            return;
+        try {
+            static_cast<void>(finish());
+        } catch(...) {}
+    }
+
+    [[nodiscard]] std::uint64_t capacity() const noexcept {
+        return bufferSize;
+    }
+
+    // Whether a write failed, after which nothing more is written.
+    [[nodiscard]] bool failed() const noexcept {
+        return broken.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] std::string backend() const {
+        return !ring ? "pwrite" : registeredBuffers ? "io_uring, registered buffers" : "io_uring";
+    }
+
+    // A free buffer, waiting for one if all are being written.
+    [[nodiscard]] std::pair<std::uint32_t, std::uint8_t*> acquire() {
+        std::unique_lock lock {mutex};
+        if(freeBuffers.empty()) {
+            ++waits;
+            freed.wait(lock, [&] { return !freeBuffers.empty(); });
+        }
+        std::uint32_t buffer {freeBuffers.back()};
+        freeBuffers.pop_back();
+        return {buffer, data(buffer)};
+    }
+
+    void submit(const ScoreBlock& block) {
+        {
+            std::lock_guard lock {mutex};
+            filled.push_back(block);
+        }
+        filledUp.notify_one();
+    }
+
+    /*
+     * Writes what is left and stops the writer. Returns how often a worker
+     * had to wait for a buffer; throws if a write failed.
+     */
+    std::uint64_t finish() {
+        {
+            std::lock_guard lock {mutex};
+            closing = true;
+        }
+        filledUp.notify_one();
+        writer.join();
+        if(error)
+            std::rethrow_exception(error);
+        return waits;
+    }
+};
+
+/*
+ * runSimulation that also hands the score of every round to 'writer'. Byte i
+ * of the file is the score of round i, numbered as runSimulation's threads
+ * split them. The workers stop once a write failed.
+ */
+[[nodiscard]] inline Int runStreamedSimulation(State seed, std::uint64_t roundCount,
+        ScoreWriter& writer) {
+    Int maxCount {0};
+
+    forEachWorker(seed, roundCount,
+            [&](State& generator, std::uint64_t begin, std::uint64_t end) {
+        Int threadMax {0};
+        for(std::uint64_t i {begin}; i < end && !writer.failed(); i += writer.capacity()) {
+            auto [buffer, data] {writer.acquire()};
+            std::uint64_t length {std::min(writer.capacity(), end - i)};
+            for(std::uint64_t j {0}; j < length; ++j) {
+                Int count {calculateRound(deriveNewState(generator))};
+                data[j] = static_cast<std::uint8_t>(count);
+                threadMax = std::max(threadMax, count);
+            }
+            writer.submit({.buffer = buffer, .round = i, .length = length});
+        }
+
+        # pragma omp critical
+        maxCount = std::max(maxCount, threadMax);
+    });
+
+    return maxCount;
+}
+
+/*
+ * Reads back 'samples' rounds spread over the file and compares them with
+ * calculateRound. Returns the number of mismatches.
+ */
+[[nodiscard]] inline std::uint64_t checkScoreFile(int fd, State seed, std::uint64_t roundCount,
+        std::uint64_t samples) {
+    std::uint64_t threads {static_cast<std::uint64_t>(omp_get_max_threads())};
+    std::uint64_t mismatches {0};
+    for(std::uint64_t k {0}; k < samples && roundCount != 0; ++k) {
+        std::uint64_t round {(k * 0x9e3779b97f4a7c15) % roundCount};
+        std::uint64_t thread {0};
+        while(workerRange(seed, roundCount, thread, threads).end <= round)
+            ++thread;
+        WorkerRange range {workerRange(seed, roundCount, thread, threads)};
+        State state {jumpAhead(range.state, 2 * (round - range.begin))};
+
+        std::uint8_t stored {0};
+        if(pread(fd, &stored, 1, static_cast<off_t>(round)) != 1)
+            throwSystemError("pread");
+        mismatches += stored != calculateRound(deriveNewState(state));
+    }
+    return mismatches;
+}
+
+/*
+ * Runs 'rounds=' rounds and writes every round's score as one byte to
+ * 'output=' (default scores.bin), through 'buffers=' buffers (default 16) of
+ * 'buffer=' bytes (default 1 MiB) and io_uring, or pwrite with 'io=pwrite' or
+ * where io_uring is missing. With 'compare=1' (the default) the same rounds
+ * are first run without writing. 'check=' rounds (default 1000) are read back
+ * and compared with calculateRound at the end.
+ */
+inline int runScoresMode(const Options& options, State seed) {
+    std::uint64_t roundCount {options.getUnsigned("rounds", rounds)};
+    std::string output {options.getString("output", "scores.bin")};
+    std::uint64_t buffers {options.getUnsigned("buffers", defaultScoreBuffers)};
+    std::uint64_t bufferSize {options.getUnsigned("buffer", defaultScoreBuffer)};
+    std::string io {options.getString("io", "uring")};
+    bool compare {options.getUnsigned("compare", 1) != 0};
+    std::uint64_t checks {options.getUnsigned("check", defaultScoreChecks)};
+    if(io != "uring" && io != "pwrite")
+        throw std::invalid_argument {"io must be uring or pwrite"};
+    if(buffers == 0 || buffers > 1024 || bufferSize == 0 || bufferSize > (1u << 30))
+        throw std::invalid_argument {"buffers must be 1 to 1024 and buffer 1 byte to 1 GiB"};
+
+    if(compare) {
+        Stopwatch stopwatch;
+        Int maxCount {runSimulation(seed, roundCount, calculateRound)};
+        double seconds {stopwatch.seconds()};
+        std::cerr << "Compute only: " << static_cast<std::uint64_t>(roundCount / seconds)
+            << " rounds/s, max " << maxCount << std::endl;
+    }
+
+    FileDescriptor fd {open(output.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+    if(fd.get() < 0)
+        throwSystemError(output);
+
+    Stopwatch stopwatch;
+    Int maxCount {0};
+    std::uint64_t waits {0};
+    std::string backend;
+    {
+        ScoreWriter writer {fd.get(), static_cast<std::uint32_t>(buffers), bufferSize, io == "uring"};
+        backend = writer.backend();
+        maxCount = runStreamedSimulation(seed, roundCount, writer);
+        waits = writer.finish();
+    }
+    double seconds {stopwatch.seconds()};
+    std::cerr << "Writing (" << backend << "): " << static_cast<std::uint64_t>(roundCount / seconds)
+        << " rounds/s, " << roundCount / seconds / 1e6 << " MB/s, workers waited for a buffer "
+        << waits << " times, max " << maxCount << std::endl;
+
+    std::uint64_t mismatches {checkScoreFile(fd.get(), seed, roundCount, checks)};
+    std::cerr << mismatches << " of " << checks << " rounds read back from " << output
+        << " differ from calculateRound" << std::endl;
+    return mismatches == 0 ? 0 : 1;
+}
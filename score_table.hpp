@@ -0,0 +1,529 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+
+/*
+ * Pairs of bits never straddle the middle of an output, so the hits of a round
+ * split into the hits in the lower halves of its outputs, which only depend on
+ * u, and the ones in the upper halves, which only depend on v. Each half is a
+ * function of a single 32-bit number and can be tabulated on its own.
+ */
+struct Half {
+    Int multiplier;
+    Int lastBitmask;
+};
+
+static inline constexpr Half halfU
+    {.multiplier = uMultiplier,
+     .lastBitmask = remainingAttemptsBitmask & lowerHalfBitMask};
+static inline constexpr Half halfV
+    {.multiplier = vMultiplier,
+     .lastBitmask = remainingAttemptsBitmask >> halfBitSize};
+
+static inline constexpr Int maxHalfScore
+    {completeAttempts * numberOfExtractedPairs / 2 + remainingAttempts};
+
+/*
+ * Counts the hits of one half of a round whose generator has already been
+ * stepped once, i.e. 'x' already is the state that yields the first output.
+ */
+[[nodiscard]] inline constexpr Int calculateSteppedHalf(Int x, Half half)
+        noexcept {
+    Int count {0};
+    for(Int i = 0; i < completeAttempts; ++i) {
+        count += countPairwiseZeroBits(x & lowerHalfBitMask);
+        x = nextHalf(x, half.multiplier);
+    }
+
+    return count + countPairwiseZeroBits(x & half.lastBitmask);
+}
+
+/*
+ * Counts the hits of one half of the round seeded with 'seed'.
+ * calculateRound(s) == calculateHalf(s.u, halfU) + calculateHalf(s.v, halfV).
+ */
+[[nodiscard]] inline constexpr Int calculateHalf(Int seed, Half half) noexcept {
+    return calculateSteppedHalf(nextHalf(seed, half.multiplier), half);
+}
+
+/*
+ * The most hits one half can have, i.e. every pair of every output hit.
+ */
+[[nodiscard]] inline constexpr Int maxScoreOf(Half half) noexcept {
+    return completeAttempts * numberOfExtractedPairs / 2
+        + static_cast<Int>(std::popcount(half.lastBitmask)) / 2;
+}
+
+/*
+ * After a single step the carry of a multiply-with-carry half is at most its
+ * multiplier, so only (multiplier + 1) * 2^16 states can ever be looked up.
+ * Indexing by the stepped state instead of the seed drops the rest.
+ */
+[[nodiscard]] inline constexpr std::uint64_t reachableStates(Half half) noexcept {
+    return static_cast<std::uint64_t>(half.multiplier + 1) << halfBitSize;
+}
+
+static inline constexpr std::uint64_t allStates
+    {static_cast<std::uint64_t>(1) << bitSize};
+
+/*
+ * One byte per entry. A storage either builds its own copy or uses one built
+ * into memory it does not own, e.g. a shared mapping.
+ */
+class ByteStorage {
+    std::unique_ptr<std::uint8_t[]> bytes;
+    const std::uint8_t* data {nullptr};
+    std::uint64_t size {0};
+
+public:
+    static inline constexpr const char* name {"byte"};
+
+    [[nodiscard]] static constexpr std::uint64_t bytesFor(std::uint64_t entries) noexcept {
+        return entries;
+    }
+
+    template<typename Score>
+    static void fill(std::uint8_t* out, std::uint64_t entries, const Score& score) {
+        # pragma omp parallel for schedule(static, 1 << 16)
+        for(std::uint64_t i = 0; i < entries; ++i)
+            out[i] = static_cast<std::uint8_t>(score(i));
+    }
+
+    template<typename Score>
+    void build(std::uint64_t entries, const Score& score) {
+        size = bytesFor(entries);
+        bytes.reset(new std::uint8_t[size]);
+        fill(bytes.get(), entries, score);
+        data = bytes.get();
+    }
+
+    void attach(const std::uint8_t* filled, std::uint64_t entries) noexcept {
+        bytes.reset();
+        data = filled;
+        size = bytesFor(entries);
+    }
+
+    [[nodiscard]] Int get(std::uint64_t index) const noexcept {
+        return data[index];
+    }
+
+    [[nodiscard]] const void* address(std::uint64_t index) const noexcept {
+        return data + index;
+    }
+
+    [[nodiscard]] std::uint64_t memory() const noexcept {
+        return size;
+    }
+};
+
+/*
+ * Seven bits per entry, enough for any half score. Eight entries fill exactly
+ * seven bytes, so the table is built in groups of eight without two threads
+ * ever touching the same byte. An entry is read with a single unaligned load.
+ */
+class PackedStorage {
+    static inline constexpr std::uint64_t entryBits {7};
+    static inline constexpr std::uint64_t entryMask {(1 << entryBits) - 1};
+    static inline constexpr std::uint64_t groupEntries {8};
+    static inline constexpr std::uint64_t groupBytes {entryBits};
+
+    static_assert(maxHalfScore <= entryMask,
+            "A half score does not fit into a packed entry");
+
+    std::unique_ptr<std::uint8_t[]> bytes;
+    const std::uint8_t* data {nullptr};
+    std::uint64_t size {0};
+
+public:
+    static inline constexpr const char* name {"packed"};
+
+    [[nodiscard]] static constexpr std::uint64_t bytesFor(std::uint64_t entries) noexcept {
+        // Padding so that the load of the last entry stays inside the buffer.
+        return (entries + groupEntries - 1) / groupEntries * groupBytes + sizeof(std::uint64_t);
+    }
+
+    template<typename Score>
+    static void fill(std::uint8_t* out, std::uint64_t entries, const Score& score) {
+        std::uint64_t groups {(entries + groupEntries - 1) / groupEntries};
+        std::memset(out + groups * groupBytes, 0, sizeof(std::uint64_t));
+
+        # pragma omp parallel for schedule(static, 1 << 13)
+        for(std::uint64_t group = 0; group < groups; ++group) {
+            std::uint64_t packed {0};
+            for(std::uint64_t j = 0; j < groupEntries; ++j) {
+                std::uint64_t index {group * groupEntries + j};
+                std::uint64_t entry {index < entries ? score(index) : 0};
+                packed |= entry << (j * entryBits);
+            }
+
+            // FIXME: Assumes a little-endian host.
+            std::memcpy(out + group * groupBytes, &packed, groupBytes);
+        }
+    }
+
+    template<typename Score>
+    void build(std::uint64_t entries, const Score& score) {
+        size = bytesFor(entries);
+        bytes.reset(new std::uint8_t[size]);
+        fill(bytes.get(), entries, score);
+        data = bytes.get();
+    }
+
+    void attach(const std::uint8_t* filled, std::uint64_t entries) noexcept {
+        bytes.reset();
+        data = filled;
+        size = bytesFor(entries);
+    }
+
+    [[nodiscard]] Int get(std::uint64_t index) const noexcept {
+        std::uint64_t bit {index * entryBits};
+        std::uint64_t word;
+        std::memcpy(&word, data + bit / 8, sizeof(word));
+        return static_cast<Int>((word >> (bit % 8)) & entryMask);
+    }
+
+    [[nodiscard]] const void* address(std::uint64_t index) const noexcept {
+        return data + index * entryBits / 8;
+    }
+
+    [[nodiscard]] std::uint64_t memory() const noexcept {
+        return size;
+    }
+};
+
+/*
+ * The table of one half, indexed either by the seed itself (all 2^32 states) or
+ * by the state after the first step (only the reachable ones).
+ */
+template<typename Storage, bool reachable>
+class HalfTable {
+    Half half;
+    Storage storage;
+
+    [[nodiscard]] static std::uint64_t entriesOf(Half h) noexcept {
+        return reachable ? reachableStates(h) : allStates;
+    }
+
+    [[nodiscard]] static Int entryScore(Half h, std::uint64_t i) noexcept {
+        if constexpr (reachable)
+            return calculateSteppedHalf(static_cast<Int>(i), h);
+        else
+            return calculateHalf(static_cast<Int>(i), h);
+    }
+
+public:
+    explicit HalfTable(Half h): half{h} {
+        storage.build(entriesOf(h), [h](std::uint64_t i) { return entryScore(h, i); });
+    }
+
+    // The table 'fill' wrote into 'filled', which must outlive it.
+    HalfTable(Half h, const std::uint8_t* filled): half{h} {
+        storage.attach(filled, entriesOf(h));
+    }
+
+    [[nodiscard]] static std::uint64_t bytes(Half h) noexcept {
+        return Storage::bytesFor(entriesOf(h));
+    }
+
+    static void fill(Half h, std::uint8_t* out) {
+        Storage::fill(out, entriesOf(h), [h](std::uint64_t i) { return entryScore(h, i); });
+    }
+
+    [[nodiscard]] std::uint64_t index(Int seed) const noexcept {
+        if constexpr (reachable)
+            return nextHalf(seed, half.multiplier);
+        else
+            return seed;
+    }
+
+    [[nodiscard]] std::uint64_t entries() const noexcept {
+        return entriesOf(half);
+    }
+
+    [[nodiscard]] Int scoreAt(std::uint64_t i) const noexcept {
+        return storage.get(i);
+    }
+
+    [[nodiscard]] Int score(Int seed) const noexcept {
+        return storage.get(index(seed));
+    }
+
+    [[nodiscard]] const void* address(Int seed) const noexcept {
+        return storage.address(index(seed));
+    }
+
+    [[nodiscard]] std::uint64_t memory() const noexcept {
+        return storage.memory();
+    }
+};
+
+/*
+ * Scores whole rounds with two lookups instead of calculateRound.
+ */
+template<typename Storage, bool reachable>
+class ScoreTable {
+public:
+    using Table = HalfTable<Storage, reachable>;
+
+    Table u {halfU};
+    Table v {halfV};
+
+    ScoreTable() = default;
+
+    // The halves 'Table::fill' wrote into 'filledU' and 'filledV'.
+    ScoreTable(const std::uint8_t* filledU, const std::uint8_t* filledV)
+        : u{halfU, filledU}, v{halfV, filledV} {}
+
+    [[nodiscard]] Int operator()(State state) const noexcept {
+        return u.score(state.u) + v.score(state.v);
+    }
+
+    [[nodiscard]] std::uint64_t memory() const noexcept {
+        return u.memory() + v.memory();
+    }
+};
+
+/*
+ * One bit per reachable state, set if the half score reaches 'threshold'.
+ */
+class HalfBitmap {
+    Half half;
+    Int limit;
+    std::unique_ptr<std::uint64_t[]> words;
+    std::uint64_t size;
+
+public:
+    HalfBitmap(Half h, Int threshold)
+            : half{h}, limit{threshold},
+              size{(reachableStates(h) + 63) / 64} {
+        words.reset(new std::uint64_t[size]);
+        std::uint64_t* data {words.get()};
+        std::uint64_t entries {reachableStates(h)};
+
+        # pragma omp parallel for schedule(static, 1 << 10)
+        for(std::uint64_t w = 0; w < size; ++w) {
+            std::uint64_t bits {0};
+            for(std::uint64_t j = 0; j < 64 && w * 64 + j < entries; ++j) {
+                Int score {calculateSteppedHalf(static_cast<Int>(w * 64 + j), h)};
+                bits |= static_cast<std::uint64_t>(score >= threshold) << j;
+            }
+            data[w] = bits;
+        }
+    }
+
+    [[nodiscard]] bool high(Int seed) const noexcept {
+        std::uint64_t i {nextHalf(seed, half.multiplier)};
+        return (words[i / 64] >> (i % 64)) & 1;
+    }
+
+    [[nodiscard]] Int threshold() const noexcept {
+        return limit;
+    }
+
+    [[nodiscard]] std::uint64_t memory() const noexcept {
+        return size * sizeof(std::uint64_t);
+    }
+};
+
+/*
+ * Keeps only a bitmap of the states with a high half score in memory. A round
+ * in which neither half is high scores at most both thresholds minus two, so
+ * only the remaining rounds are evaluated with calculateRound. Scores below
+ * exactFrom() are not needed for a maximum and are reported as 0. Both
+ * thresholds must be positive.
+ */
+class TieredTable {
+    HalfBitmap u;
+    HalfBitmap v;
+
+public:
+    TieredTable(Int thresholdU, Int thresholdV)
+            : u{halfU, thresholdU}, v{halfV, thresholdV} {}
+
+    [[nodiscard]] Int operator()(State state) const noexcept {
+        if(u.high(state.u) || v.high(state.v))
+            return calculateRound(state);
+        return 0;
+    }
+
+    [[nodiscard]] Int exactFrom() const noexcept {
+        return u.threshold() + v.threshold() - 1;
+    }
+
+    [[nodiscard]] std::uint64_t memory() const noexcept {
+        return u.memory() + v.memory();
+    }
+};
+
+[[nodiscard]] inline std::uint64_t physicalMemory() noexcept {
+    return static_cast<std::uint64_t>(sysconf(_SC_PHYS_PAGES))
+        * static_cast<std::uint64_t>(sysconf(_SC_PAGE_SIZE));
+}
+
+static inline constexpr Int defaultTierU {44};
+static inline constexpr Int defaultTierV {42};
+static inline constexpr std::uint64_t tableCheckRounds {1 << 20};
+
+/*
+ * Compares 'kernel' against calculateRound on rounds drawn from a stream
+ * independent of the simulation. Rounds that score below 'exactFrom' only need
+ * to be reported below it.
+ */
+template<typename Kernel>
+[[nodiscard]] bool checkKernel(const Kernel& kernel, Int exactFrom = 0) noexcept {
+    State state {.u = 0x9e3779b9, .v = 0x7f4a7c15};
+    for(std::uint64_t i {0}; i < tableCheckRounds; ++i) {
+        State round {deriveNewState(state)};
+        Int expected {calculateRound(round)};
+        Int actual {kernel(round)};
+        bool ok {expected >= exactFrom ? actual == expected : actual < exactFrom};
+        if(!ok) {
+            std::cerr << "Mismatch for u=" << round.u << " v=" << round.v
+                << ": expected " << expected << " but got " << actual
+                << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Builds the lookup table with the given format name and passes it to 'f'.
+ * Returns false for an unknown name.
+ */
+template<typename F>
+bool visitScoreTable(std::string_view format, const F& f) {
+    if(format == "full") {
+        f(ScoreTable<ByteStorage, false>{});
+    } else if(format == "packed") {
+        f(ScoreTable<PackedStorage, false>{});
+    } else if(format == "reachable") {
+        f(ScoreTable<ByteStorage, true>{});
+    } else if(format == "reachable-packed") {
+        f(ScoreTable<PackedStorage, true>{});
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Like visitScoreTable, but only builds the table of one half.
+ */
+template<typename F>
+bool visitHalfTable(std::string_view format, Half half, const F& f) {
+    if(format == "full") {
+        f(HalfTable<ByteStorage, false>{half});
+    } else if(format == "packed") {
+        f(HalfTable<PackedStorage, false>{half});
+    } else if(format == "reachable") {
+        f(HalfTable<ByteStorage, true>{half});
+    } else if(format == "reachable-packed") {
+        f(HalfTable<PackedStorage, true>{half});
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+struct TableFormat {
+    const char* name;
+    std::uint64_t memory;
+};
+
+/*
+ * Memory needed by each format, known before building it.
+ */
+static inline constexpr TableFormat tableFormats[] {
+    {"compute", 0},
+    {"full", 2 * allStates},
+    {"packed", 2 * (allStates * 7 / 8)},
+    {"reachable", reachableStates(halfU) + reachableStates(halfV)},
+    {"reachable-packed",
+        (reachableStates(halfU) + reachableStates(halfV)) * 7 / 8},
+    {"tiered", (reachableStates(halfU) + reachableStates(halfV)) / 8},
+};
+
+template<typename Kernel>
+bool reportTableRun(const char* format, const Kernel& kernel,
+        std::uint64_t memory, double buildSeconds, State seed,
+        std::uint64_t roundCount, Int exactFrom = 0) {
+    if(!checkKernel(kernel, exactFrom))
+        return false;
+
+    Stopwatch stopwatch;
+    Int maxHits {runSimulation(seed, roundCount, kernel)};
+    double seconds {stopwatch.seconds()};
+
+    std::cerr << format << ": " << memory / (1 << 20) << " MiB, built in "
+        << buildSeconds << " s, " << static_cast<std::uint64_t>(roundCount / seconds)
+        << " rounds/s, max " << maxHits;
+    if(maxHits < exactFrom)
+        std::cerr << " (only known to be below " << exactFrom << ")";
+    std::cerr << std::endl;
+    return true;
+}
+
+/*
+ * Builds the score tables of one format (or of all formats that fit into
+ * 'memory' bytes), checks them against calculateRound and reports their size
+ * against the throughput of a simulation using them.
+ */
+inline int runTablesMode(const Options& options, State seed) {
+    std::string format {options.getString("format", "all")};
+    std::uint64_t roundCount {options.getUnsigned("rounds", rounds)};
+    std::uint64_t memoryLimit {options.getUnsigned("memory", physicalMemory())};
+    Int tierU {static_cast<Int>(options.getUnsigned("tier-u", defaultTierU))};
+    Int tierV {static_cast<Int>(options.getUnsigned("tier-v", defaultTierV))};
+    if(tierU == 0 || tierV == 0)
+        throw std::invalid_argument {"Tier thresholds must be positive"};
+
+    bool known {false};
+    bool ok {true};
+    for(const TableFormat& candidate : tableFormats) {
+        std::string_view name {candidate.name};
+        if(format != "all" && format != name)
+            continue;
+
+        known = true;
+        if(candidate.memory > memoryLimit) {
+            std::cerr << name << ": skipped, needs "
+                << candidate.memory / (1 << 20) << " MiB" << std::endl;
+            continue;
+        }
+
+        Stopwatch build;
+        if(name == "compute") {
+            ok &= reportTableRun(candidate.name, calculateRound, 0, 0, seed,
+                    roundCount);
+        } else if(name != "tiered") {
+            visitScoreTable(name, [&](const auto& table) {
+                ok &= reportTableRun(candidate.name, table, table.memory(),
+                        build.seconds(), seed, roundCount);
+            });
+        } else {
+            TieredTable table {tierU, tierV};
+            ok &= reportTableRun(candidate.name, table, table.memory(),
+                    build.seconds(), seed, roundCount, table.exactFrom());
+        }
+    }
+
+    if(!known)
+        throw std::invalid_argument {"Unknown table format '" + format + "'"};
+    return ok ? 0 : 1;
+}
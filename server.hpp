@@ -0,0 +1,357 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <omp.h>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "external.hpp"
+#include "options.hpp"
+#include "rng.hpp"
+#include "score_table.hpp"
+#include "shared_table.hpp"
+#include "simulation.hpp"
+
+static inline constexpr const char* defaultSocket {"/tmp/random_parallel.sock"};
+// Requests of at most this many rounds are run side by side, one per thread.
+static inline constexpr std::uint64_t defaultBatchRounds {1'000'000};
+// A client whose request line grows longer than this is disconnected.
+static inline constexpr std::size_t maxRequestLine {4096};
+// Socket buffer for the replies a client has not read yet (capped by wmem_max).
+static inline constexpr int replyBufferBytes {1 << 20};
+
+/*
+ * A client of the server. Replies are written by the executor and the I/O
+ * thread, whole lines at a time, without ever blocking: what the socket
+ * buffer cannot take at once is not queued, the client is dropped instead, so
+ * one client that stops reading cannot stall the jobs of the others.
+ */
+class Connection {
+    FileDescriptor fd;
+    std::mutex writeMutex;
+    bool dropped {false};
+
+public:
+    std::string pending;
+    std::uint64_t requests {0};
+
+    explicit Connection(int descriptor) noexcept: fd{descriptor} {
+        setsockopt(fd.get(), SOL_SOCKET, SO_SNDBUF, &replyBufferBytes, sizeof(replyBufferBytes));
+    }
+
+    [[nodiscard]] int get() const noexcept {
+        return fd.get();
+    }
+
+    // A client that went away or does not read only loses its replies.
+    void send(std::string line) {
+        line.push_back('\n');
+        std::lock_guard lock {writeMutex};
+        std::string_view rest {line};
+        while(!rest.empty() && !dropped) {
+            ssize_t n {::send(fd.get(), rest.data(), rest.size(), MSG_NOSIGNAL | MSG_DONTWAIT)};
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0) {
+                // The I/O thread then reads the end of the stream and closes it.
+                dropped = true;
+                shutdown(fd.get(), SHUT_RDWR);
+                return;
+            }
+            rest.remove_prefix(static_cast<std::size_t>(n));
+        }
+    }
+};
+
+struct Job {
+    std::shared_ptr<Connection> connection;
+    std::string id;
+    State seed;
+    std::uint64_t roundCount;
+};
+
+[[nodiscard]] inline sockaddr_un socketAddress(const std::string& path) {
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(address.sun_path))
+        throw std::invalid_argument {"Socket path too long: " + path};
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+/*
+ * Accepts connections on a Unix domain socket and runs the simulations they
+ * request with 'kernel'. One I/O thread parses request lines and queues them;
+ * the executor thread takes everything queued at once, runs the small
+ * requests of the batch side by side on the OpenMP pool and the large ones one
+ * after another with the whole pool. All parallel regions start from the
+ * executor, so the pool and the kernel's tables stay warm between requests.
+ */
+template<typename Kernel>
+class Server {
+    const Kernel& kernel;
+    State defaultSeed;
+    std::uint64_t batchRounds;
+    std::uint64_t threads {static_cast<std::uint64_t>(omp_get_max_threads())};
+
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::deque<Job> queue;
+    bool stopping {false};
+
+    void reply(const Job& job, Int maxCount, double seconds) {
+        std::ostringstream line;
+        line << "ok id=" << job.id << " max=" << maxCount << " rounds="
+            << job.roundCount << " seconds=" << seconds;
+        job.connection->send(line.str());
+    }
+
+    void runBatch(std::vector<Job>& batch) {
+        std::vector<Job> small;
+        for(Job& job : batch) {
+            if(job.roundCount <= batchRounds) {
+                small.push_back(std::move(job));
+            } else {
+                Stopwatch stopwatch;
+                Int maxCount {runSimulation(job.seed, job.roundCount, kernel)};
+                reply(job, maxCount, stopwatch.seconds());
+            }
+        }
+
+        // The same maxima as runSimulation on the whole pool would find.
+        # pragma omp parallel for schedule(dynamic, 1)
+        for(std::size_t i = 0; i < small.size(); ++i) {
+            Stopwatch stopwatch;
+            Int maxCount {runSimulationAs(small[i].seed, small[i].roundCount, kernel, threads)};
+            reply(small[i], maxCount, stopwatch.seconds());
+        }
+    }
+
+    void execute() {
+        std::vector<Job> batch;
+        while(true) {
+            {
+                std::unique_lock lock {queueMutex};
+                queueChanged.wait(lock, [&] { return stopping || !queue.empty(); });
+                if(queue.empty())
+                    return;
+                batch.assign(std::make_move_iterator(queue.begin()),
+                        std::make_move_iterator(queue.end()));
+                queue.clear();
+            }
+            runBatch(batch);
+            batch.clear();
+        }
+    }
+
+    /*
+     * Handles one request line, skipping blank ones. Returns false on
+     * 'shutdown'.
+     */
+    bool handle(const std::shared_ptr<Connection>& connection, std::string_view line) {
+        if(line.find_first_not_of(" \t\r\n") == std::string_view::npos)
+            return true;
+        std::string id {std::to_string(connection->requests++)};
+        try {
+            Options request {line};
+            id = request.getString("id", id);
+            const std::string& op {request.mode()};
+            if(op.empty())
+                throw std::invalid_argument {"missing request"};
+            if(op == "ping") {
+                connection->send("ok id=" + id);
+                return true;
+            }
+            if(op == "shutdown") {
+                connection->send("ok id=" + id);
+                return false;
+            }
+            if(op != "simulate")
+                throw std::invalid_argument {"Unknown request '" + op + "'"};
+
+            Job job {.connection = connection, .id = id,
+                .seed = {.u = static_cast<Int>(request.getUnsigned("u", defaultSeed.u)),
+                         .v = static_cast<Int>(request.getUnsigned("v", defaultSeed.v))},
+                .roundCount = request.getUnsigned("rounds", batchRounds)};
+            {
+                std::lock_guard lock {queueMutex};
+                queue.push_back(std::move(job));
+            }
+            queueChanged.notify_one();
+        } catch(const std::exception& e) {
+            connection->send("error id=" + id + " " + e.what());
+        }
+        return true;
+    }
+
+    /*
+     * Reads whatever arrived and handles every complete line. Returns false
+     * when the client is gone or sent a line longer than maxRequestLine.
+     */
+    bool receive(const std::shared_ptr<Connection>& connection, bool& running) {
+        char buffer[4096];
+        ssize_t n {read(connection->get(), buffer, sizeof(buffer))};
+        if(n < 0 && errno == EINTR)
+            return true;
+        if(n <= 0)
+            return false;
+
+        connection->pending.append(buffer, static_cast<std::size_t>(n));
+        std::size_t end;
+        while(running && (end = connection->pending.find('\n')) != std::string::npos) {
+            running = handle(connection, std::string_view{connection->pending}.substr(0, end));
+            connection->pending.erase(0, end + 1);
+        }
+        return connection->pending.size() <= maxRequestLine;
+    }
+
+public:
+    Server(const Kernel& k, State seed, std::uint64_t batch) noexcept
+        : kernel{k}, defaultSeed{seed}, batchRounds{batch} {}
+
+    void serve(const std::string& path) {
+        sockaddr_un address {socketAddress(path)};
+        FileDescriptor listener {socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+        if(listener.get() < 0)
+            throwSystemError("socket");
+        unlink(path.c_str());
+        if(bind(listener.get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+            throwSystemError(path);
+        if(listen(listener.get(), SOMAXCONN) != 0)
+            throwSystemError("listen");
+        std::cerr << "Listening on " << path << " with " << threads << " threads"
+            << std::endl;
+
+        std::thread executor {[this] { execute(); }};
+        std::vector<std::shared_ptr<Connection>> connections;
+        bool running {true};
+        int pollError {0};
+        while(running) {
+            std::vector<pollfd> fds {{.fd = listener.get(), .events = POLLIN, .revents = 0}};
+            for(const auto& connection : connections)
+                fds.push_back({.fd = connection->get(), .events = POLLIN, .revents = 0});
+            if(poll(fds.data(), fds.size(), -1) < 0) {
+                if(errno == EINTR)
+                    continue;
+                pollError = errno;
+                break;
+            }
+
+            for(std::size_t i {fds.size()}; i-- > 1;)
+                if(fds[i].revents != 0 && (!running || !receive(connections[i - 1], running)))
+                    connections.erase(connections.begin() + static_cast<std::ptrdiff_t>(i - 1));
+
+            if(running && (fds[0].revents & POLLIN)) {
+                int client {accept4(listener.get(), nullptr, nullptr, SOCK_CLOEXEC)};
+                if(client >= 0)
+                    connections.push_back(std::make_shared<Connection>(client));
+            }
+        }
+
+        // Queued requests are still answered before the server exits.
+        {
+            std::lock_guard lock {queueMutex};
+            stopping = true;
+        }
+        queueChanged.notify_one();
+        executor.join();
+        unlink(path.c_str());
+        if(pollError != 0) {
+            errno = pollError;
+            throwSystemError("poll");
+        }
+    }
+};
+
+/*
+ * Serves simulation requests on the Unix domain socket 'socket=' until a
+ * client sends 'shutdown'. 'format=' keeps a score table of that format in
+ * memory for all requests instead of computing the rounds, mapped from
+ * 'table-file=' if given.
+ */
+inline int runServerMode(const Options& options, State seed) {
+    std::string path {options.getString("socket", defaultSocket)};
+    std::string format {options.getString("format", "compute")};
+    std::uint64_t batchRounds {options.getUnsigned("batch", defaultBatchRounds)};
+
+    if(format == "compute") {
+        Server server {calculateRound, seed, batchRounds};
+        server.serve(path);
+        return 0;
+    }
+
+    Stopwatch stopwatch;
+    bool known {visitSharedScoreTable(options, format, [&](const auto& table) {
+        std::cerr << "The " << format << " table is ready after " << stopwatch.seconds()
+            << " s" << std::endl;
+        Server server {table, seed, batchRounds};
+        server.serve(path);
+    })};
+    if(!known)
+        throw std::invalid_argument {"Unknown format '" + format + "'"};
+    return 0;
+}
+
+/*
+ * Sends 'request=' to the server 'repeat=' times, waiting for every reply,
+ * prints the last reply and the round trip times.
+ */
+inline int runClientMode(const Options& options, State) {
+    std::string path {options.getString("socket", defaultSocket)};
+    std::string request {options.getString("request", "ping") + "\n"};
+    std::uint64_t repeat {std::max<std::uint64_t>(options.getUnsigned("repeat", 1), 1)};
+
+    sockaddr_un address {socketAddress(path)};
+    FileDescriptor fd {socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+    if(fd.get() < 0)
+        throwSystemError("socket");
+    if(connect(fd.get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+        throwSystemError(path);
+
+    std::vector<double> latencies;
+    std::string pending;
+    std::string last;
+    for(std::uint64_t i {0}; i < repeat; ++i) {
+        Stopwatch stopwatch;
+        if(write(fd.get(), request.data(), request.size()) != static_cast<ssize_t>(request.size()))
+            throwSystemError("write");
+
+        std::size_t end;
+        while((end = pending.find('\n')) == std::string::npos) {
+            char buffer[4096];
+            ssize_t n {read(fd.get(), buffer, sizeof(buffer))};
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                throw std::runtime_error {"Server closed the connection"};
+            pending.append(buffer, static_cast<std::size_t>(n));
+        }
+        latencies.push_back(stopwatch.seconds());
+        last = pending.substr(0, end);
+        pending.erase(0, end + 1);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << last << std::endl;
+    std::cerr << repeat << " requests, round trip min " << latencies.front() * 1e6
+        << " us, median " << latencies[latencies.size() / 2] * 1e6 << " us, max "
+        << latencies.back() * 1e6 << " us" << std::endl;
+    return last.starts_with("ok") ? 0 : 1;
+}
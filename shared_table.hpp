@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "external.hpp"
+#include "options.hpp"
+#include "rng.hpp"
+#include "score_table.hpp"
+#include "simulation.hpp"
+
+static inline constexpr char sharedTableMagic[8] {'R', 'P', 'S', 'C', 'O', 'R', 'E', '\0'};
+static inline constexpr std::uint32_t sharedTableVersion {1};
+
+/*
+ * The start of a shared table file. Everything a table's contents depend on
+ * is recorded, so a file from another version of the program, another format
+ * or other generator parameters is never used. The magic is written last:
+ * a file without it is one whose build did not finish.
+ */
+struct SharedTableHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t headerSize;
+    char format[32];
+    std::uint32_t uMultiplier;
+    std::uint32_t vMultiplier;
+    std::uint32_t attempts;
+    std::uint32_t padding;
+    std::uint64_t offsetU;
+    std::uint64_t bytesU;
+    std::uint64_t offsetV;
+    std::uint64_t bytesV;
+    std::uint64_t fileSize;
+};
+
+[[nodiscard]] inline constexpr std::uint64_t alignUp(std::uint64_t n, std::uint64_t alignment) noexcept {
+    return (n + alignment - 1) / alignment * alignment;
+}
+
+/*
+ * A ScoreTable whose halves live in a file that every process maps read-only
+ * and shared, so concurrent jobs share one copy in the page cache (or in huge
+ * pages, with the file on hugetlbfs). A complete file is never written again,
+ * so mapping it needs no lock. A process that finds no usable file takes an
+ * exclusive flock on '<file>.lock' and, unless another one built it in the
+ * meantime, replaces it with a freshly built one. Unlinking leaves processes
+ * still mapping the old file undisturbed.
+ */
+template<typename Storage, bool reachable>
+class SharedScoreTable {
+    using Table = ScoreTable<Storage, reachable>;
+    using HalfTableType = typename Table::Table;
+
+    SharedMapping mapping;
+    std::optional<Table> table;
+    bool built {false};
+
+    [[nodiscard]] static SharedTableHeader expectedHeader(std::string_view format,
+            std::uint64_t alignment) {
+        SharedTableHeader header {};
+        std::memcpy(header.magic, sharedTableMagic, sizeof(header.magic));
+        header.version = sharedTableVersion;
+        header.headerSize = sizeof(SharedTableHeader);
+        format.copy(header.format, sizeof(header.format) - 1);
+        header.uMultiplier = uMultiplier;
+        header.vMultiplier = vMultiplier;
+        header.attempts = attempts;
+        header.bytesU = HalfTableType::bytes(halfU);
+        header.bytesV = HalfTableType::bytes(halfV);
+        header.offsetU = alignUp(sizeof(SharedTableHeader), alignment);
+        header.offsetV = alignUp(header.offsetU + header.bytesU, alignment);
+        header.fileSize = alignUp(header.offsetV + header.bytesV, alignment);
+        return header;
+    }
+
+    // Why the file cannot be used, or nothing if it can.
+    [[nodiscard]] static std::optional<std::string> mismatch(const SharedTableHeader& header,
+            const SharedTableHeader& expected, std::uint64_t fileSize) {
+        if(std::memcmp(header.magic, sharedTableMagic, sizeof(header.magic)) != 0)
+            return "incomplete";
+        if(header.version != expected.version || header.headerSize != expected.headerSize)
+            return "version " + std::to_string(header.version);
+        if(std::strncmp(header.format, expected.format, sizeof(header.format)) != 0)
+            return "format " + std::string{header.format, strnlen(header.format, sizeof(header.format))};
+        if(header.uMultiplier != expected.uMultiplier || header.vMultiplier != expected.vMultiplier
+                || header.attempts != expected.attempts)
+            return "other generator parameters";
+        if(header.bytesU != expected.bytesU || header.bytesV != expected.bytesV
+                || header.offsetU < sizeof(SharedTableHeader)
+                || header.offsetU + header.bytesU > fileSize
+                || header.offsetV + header.bytesV > fileSize || header.fileSize > fileSize)
+            return "wrong layout";
+        return std::nullopt;
+    }
+
+    // Huge pages on hugetlbfs, whose block size is the huge page size.
+    [[nodiscard]] static std::uint64_t alignmentOf(const struct stat& info) noexcept {
+        return std::max<std::uint64_t>(4096, static_cast<std::uint64_t>(info.st_blksize));
+    }
+
+    /*
+     * Maps the file at 'path' if it is complete and matches 'format'. Returns
+     * why not otherwise, "missing" if there is no file.
+     */
+    [[nodiscard]] std::optional<std::string> tryMap(const std::string& path,
+            std::string_view format) {
+        FileDescriptor fd {open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+        if(fd.get() < 0) {
+            if(errno == ENOENT)
+                return "missing";
+            throwSystemError(path);
+        }
+        struct stat info;
+        if(fstat(fd.get(), &info) != 0)
+            throwSystemError(path);
+        std::uint64_t fileSize {static_cast<std::uint64_t>(info.st_size)};
+        if(fileSize < sizeof(SharedTableHeader))
+            return "incomplete";
+
+        SharedTableHeader header;
+        if(pread(fd.get(), &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)))
+            return "incomplete";
+        std::optional<std::string> problem {mismatch(header,
+                expectedHeader(format, alignmentOf(info)), fileSize)};
+        if(problem)
+            return problem;
+
+        mapping = SharedMapping {fd.get(), header.fileSize, PROT_READ};
+        table.emplace(mapping.data() + header.offsetU, mapping.data() + header.offsetV);
+        return std::nullopt;
+    }
+
+    // Builds a new file at 'path', which must not exist.
+    static void build(const std::string& path, std::string_view format) {
+        FileDescriptor fd {open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644)};
+        if(fd.get() < 0)
+            throwSystemError(path);
+        struct stat info;
+        if(fstat(fd.get(), &info) != 0)
+            throwSystemError(path);
+        SharedTableHeader header {expectedHeader(format, alignmentOf(info))};
+        if(ftruncate(fd.get(), static_cast<off_t>(header.fileSize)) != 0)
+            throwSystemError("ftruncate " + path);
+
+        SharedMapping writable {fd.get(), header.fileSize, PROT_READ | PROT_WRITE};
+        HalfTableType::fill(halfU, writable.data() + header.offsetU);
+        HalfTableType::fill(halfV, writable.data() + header.offsetV);
+
+        // The tables must be in the file before the magic says they are.
+        if(msync(writable.data(), header.fileSize, MS_SYNC) != 0)
+            throwSystemError("msync " + path);
+        std::memcpy(writable.data(), &header, sizeof(header));
+        if(msync(writable.data(), header.offsetU, MS_SYNC) != 0)
+            throwSystemError("msync " + path);
+    }
+
+public:
+    SharedScoreTable(const std::string& path, std::string_view format) {
+        if(!tryMap(path, format))
+            return;
+
+        std::string lockPath {path + ".lock"};
+        FileDescriptor lock {open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)};
+        if(lock.get() < 0)
+            throwSystemError(lockPath);
+        while(flock(lock.get(), LOCK_EX) != 0)
+            if(errno != EINTR)
+                throwSystemError("flock " + lockPath);
+
+        std::optional<std::string> problem {tryMap(path, format)};
+        if(!problem)
+            return;
+        if(*problem != "missing") {
+            std::cerr << "Replacing the table in " << path << " (" << *problem << ")" << std::endl;
+            if(unlink(path.c_str()) != 0)
+                throwSystemError("unlink " + path);
+        }
+        build(path, format);
+        built = true;
+        problem = tryMap(path, format);
+        if(problem)
+            throw std::runtime_error {"The table built into " + path + " is " + *problem};
+    }
+
+    // Whether this process built the file rather than finding it.
+    [[nodiscard]] bool builtHere() const noexcept {
+        return built;
+    }
+
+    [[nodiscard]] const Table& get() const noexcept {
+        return *table;
+    }
+};
+
+/*
+ * Like visitScoreTable, but with 'table-file=' the table is mapped from that
+ * file, shared with every other process using it, and built into it first if
+ * need be. Put the file on tmpfs (e.g. /dev/shm) or hugetlbfs.
+ */
+template<typename F>
+bool visitSharedScoreTable(const Options& options, std::string_view format, const F& f) {
+    std::string path {options.getString("table-file", "")};
+    if(path.empty())
+        return visitScoreTable(format, f);
+
+    auto shared = [&]<typename Storage, bool reachable>() {
+        Stopwatch stopwatch;
+        SharedScoreTable<Storage, reachable> table {path, format};
+        std::cerr << (table.builtHere() ? "Built" : "Mapped") << " the " << format
+            << " table " << (table.builtHere() ? "into " : "from ") << path << " in "
+            << stopwatch.seconds() << " s" << std::endl;
+        f(table.get());
+    };
+
+    if(format == "full")
+        shared.template operator()<ByteStorage, false>();
+    else if(format == "packed")
+        shared.template operator()<PackedStorage, false>();
+    else if(format == "reachable")
+        shared.template operator()<ByteStorage, true>();
+    else if(format == "reachable-packed")
+        shared.template operator()<PackedStorage, true>();
+    else
+        return false;
+    return true;
+}
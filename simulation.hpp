@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <omp.h>
+
+#include "rng.hpp"
+
+// How many rounds had how many hits.
+using Histogram = std::array<std::uint64_t, attempts + 1>;
+
+struct Init {
+    State state;
+
+    [[nodiscard]] constexpr Init(State s) noexcept: state{s} {}
+
+    [[nodiscard]] Init(const Init& other) noexcept {
+        State s {other.state};
+        int ithread = omp_get_thread_num();
+        for(int i {0}; i < 2*ithread; ++i) {
+            s = deriveNewState(s);
+        }
+
+        state = s;
+    }
+};
+
+/*
+ * Run the simulation for 'roundCount' rounds, scoring every round with
+ * 'kernel', and return the maximum number of hits that have occurred in any
+ * round. The rounds are the same as the ones of the plain simulation below, so
+ * every kernel that agrees with calculateRound yields the same maximum.
+ */
+template<typename Kernel>
+[[nodiscard]] Int runSimulation(State state, std::uint64_t roundCount,
+        const Kernel& kernel) noexcept {
+    Int maxCount {0};
+    Init init {state};
+
+    # pragma omp parallel for firstprivate(init) reduction(max:maxCount)
+    for(std::uint64_t i = 0; i < roundCount; ++i) {
+        State newState { deriveNewState(init.state) };
+        Int count {kernel(newState)};
+        maxCount = std::max(maxCount, count);
+    }
+
+    return maxCount;
+}
+
+/*
+ * Run the simulation for 'rounds' rounds and return the maximum number number
+ * of hits that have occurred in any attempt.
+ */
+[[nodiscard]] inline Int runSimulation(State state) noexcept {
+    return runSimulation(state, rounds, calculateRound);
+}
+
+/*
+ * The range of rounds and the generator of thread 'thread' out of 'threads',
+ * exactly as forEachWorker and the static schedule of runSimulation use them.
+ */
+struct WorkerRange {
+    State state;
+    std::uint64_t begin;
+    std::uint64_t end;
+};
+
+[[nodiscard]] inline WorkerRange workerRange(State state, std::uint64_t roundCount,
+        std::uint64_t thread, std::uint64_t threads) noexcept {
+    for(std::uint64_t i {0}; i < 2 * thread; ++i)
+        state = deriveNewState(state);
+
+    std::uint64_t chunk {roundCount / threads};
+    std::uint64_t rest {roundCount % threads};
+    std::uint64_t begin {thread * chunk + std::min(thread, rest)};
+    return WorkerRange {.state = state, .begin = begin,
+        .end = begin + chunk + (thread < rest ? 1 : 0)};
+}
+
+/*
+ * The result runSimulation has on 'threads' threads, computed by the calling
+ * thread alone, e.g. to evaluate many small simulations side by side.
+ */
+template<typename Kernel>
+[[nodiscard]] Int runSimulationAs(State state, std::uint64_t roundCount,
+        const Kernel& kernel, std::uint64_t threads) noexcept {
+    Int maxCount {0};
+    for(std::uint64_t thread {0}; thread < threads; ++thread) {
+        WorkerRange range {workerRange(state, roundCount, thread, threads)};
+        for(std::uint64_t i {range.begin}; i < range.end; ++i)
+            maxCount = std::max(maxCount, kernel(deriveNewState(range.state)));
+    }
+
+    return maxCount;
+}
+
+/*
+ * Splits 'roundCount' rounds among the threads like the static schedule of
+ * runSimulation and calls 'body(state, begin, end)' on every thread, where
+ * 'state' is the thread's generator, for engines that work on blocks of rounds.
+ */
+template<typename Body>
+void forEachWorker(State state, std::uint64_t roundCount, const Body& body) {
+    # pragma omp parallel
+    {
+        WorkerRange range {workerRange(state, roundCount,
+                static_cast<std::uint64_t>(omp_get_thread_num()),
+                static_cast<std::uint64_t>(omp_get_num_threads()))};
+        body(range.state, range.begin, range.end);
+    }
+}
+
+class Stopwatch {
+    std::chrono::steady_clock::time_point start
+        {std::chrono::steady_clock::now()};
+
+public:
+    [[nodiscard]] double seconds() const noexcept {
+        return std::chrono::duration<double>
+            (std::chrono::steady_clock::now() - start).count();
+    }
+};
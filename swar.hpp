@@ -0,0 +1,170 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+
+#include "lanes.hpp"
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+#include "verifier.hpp"
+
+/*
+ * Two rounds in one 64-bit general purpose register, for cores with weak or no
+ * SIMD: the first round's 32-bit half of the state in the lower word, the
+ * second's in the upper one. Multiplying the lower 16 bits of each word by a
+ * 16-bit multiplier and adding the upper 16 bits stays below 2^32, so no
+ * carry crosses from one word into the other.
+ */
+using SwarWord = std::uint64_t;
+
+static inline constexpr std::uint64_t defaultSwarRounds {100'000'000};
+
+static inline constexpr SwarWord swarLowerHalves {0x0000ffff0000ffff};
+static inline constexpr SwarWord swarAlternating {0xaaaaaaaaaaaaaaaa};
+
+struct SwarState {
+    SwarWord u;
+    SwarWord v;
+};
+
+[[nodiscard]] inline constexpr SwarWord nextHalfSwar(SwarWord x, Int multiplier) noexcept {
+    return multiplier * (x & swarLowerHalves) + ((x >> halfBitSize) & swarLowerHalves);
+}
+
+// nextRandomNumber of both rounds.
+[[nodiscard]] inline constexpr SwarWord nextRandomSwar(SwarState& state) noexcept {
+    state.v = nextHalfSwar(state.v, vMultiplier);
+    state.u = nextHalfSwar(state.u, uMultiplier);
+    return ((state.v << halfBitSize) & ~swarLowerHalves) | (state.u & swarLowerHalves);
+}
+
+/*
+ * The hit pairs of both words, counted per byte (at most 4 each). Bit 31 is
+ * shifted into bit 32, an even position the mask drops, so the words stay
+ * apart.
+ */
+[[nodiscard]] inline constexpr SwarWord countPairHitsSwar(SwarWord n) noexcept {
+    SwarWord x {(n & (n << 1) & swarAlternating) >> 1};
+    x = (x & 0x3333333333333333) + ((x >> 2) & 0x3333333333333333);
+    return (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0f;
+}
+
+// The state of round 'first' in the lower words, of 'second' in the upper.
+[[nodiscard]] inline constexpr SwarState packSwar(State first, State second) noexcept {
+    return SwarState {.u = first.u | (SwarWord{second.u} << bitSize),
+        .v = first.v | (SwarWord{second.v} << bitSize)};
+}
+
+struct SwarCounts {
+    Int first;
+    Int second;
+};
+
+/*
+ * calculateRound of the two rounds packed into 'state'. The byte counts are
+ * summed over all attempts (at most 4 * 15 = 60 per byte) and only then added
+ * up per word: multiplying by 0x01010101 leaves the sum of bytes 0 to 3 in
+ * byte 3 and of bytes 4 to 7 in byte 7, and no byte sum can carry.
+ */
+[[nodiscard]] inline SwarCounts calculateRoundSwar(SwarState state) noexcept {
+    static constexpr SwarWord remainingMask {remainingAttemptsBitmask
+        | (SwarWord{remainingAttemptsBitmask} << bitSize)};
+
+    SwarWord bytes {0};
+    for(Int i = 0; i < completeAttempts; ++i)
+        bytes += countPairHitsSwar(nextRandomSwar(state));
+    bytes += countPairHitsSwar(nextRandomSwar(state) & remainingMask);
+
+    SwarWord sums {bytes * 0x01010101};
+    return SwarCounts {.first = static_cast<Int>((sums >> 24) & 0xff),
+        .second = static_cast<Int>(sums >> 56)};
+}
+
+/*
+ * runSimulation with every thread deriving two round states one after another
+ * and scoring them in one register. A 'verifier' checks a sample of the
+ * rounds, as in runRoundLanes.
+ */
+[[nodiscard]] inline Int runRoundSwar(State seed, std::uint64_t roundCount,
+        RoundVerifier* verifier = nullptr) {
+    Int maxCount {0};
+
+    forEachWorker(seed, roundCount,
+            [&](State& generator, std::uint64_t begin, std::uint64_t end) {
+        Int threadMax {0};
+        std::uint64_t i {begin};
+        for(; i + 2 <= end; i += 2) {
+            State first {deriveNewState(generator)};
+            State second {deriveNewState(generator)};
+            SwarCounts counts {calculateRoundSwar(packSwar(first, second))};
+            threadMax = std::max({threadMax, counts.first, counts.second});
+            if(verifier != nullptr) {
+                verifier->verify(first, counts.first);
+                verifier->verify(second, counts.second);
+                if(verifier->failed())
+                    break;
+            }
+        }
+        if(i < end && (verifier == nullptr || !verifier->failed()))
+            threadMax = std::max(threadMax, calculateRound(deriveNewState(generator)));
+
+        # pragma omp critical
+        maxCount = std::max(maxCount, threadMax);
+    });
+
+    return maxCount;
+}
+
+/*
+ * Checks calculateRoundSwar round by round against calculateRound on the
+ * first 'check=' rounds (default 1e6), then runs 'rounds=' rounds with the
+ * scalar, the two-rounds-per-register and the lane-per-round engines and
+ * prints their speed. 'verify=' checks that share of the rounds of the latter
+ * two against calculateRound while they run.
+ */
+inline int runSwarMode(const Options& options, State seed) {
+    std::uint64_t roundCount {options.getUnsigned("rounds", defaultSwarRounds)};
+    std::uint64_t checkCount {options.getUnsigned("check", 1'000'000)};
+
+    State generator {seed};
+    for(std::uint64_t i {0}; i < checkCount; ++i) {
+        State first {deriveNewState(generator)};
+        State second {deriveNewState(generator)};
+        SwarCounts counts {calculateRoundSwar(packSwar(first, second))};
+        if(counts.first != calculateRound(first) || counts.second != calculateRound(second)) {
+            std::cerr << "SWAR and scalar counts differ for u=" << first.u << " v=" << first.v
+                << " or u=" << second.u << " v=" << second.v << std::endl;
+            return 1;
+        }
+    }
+    std::cerr << "Checked " << 2 * checkCount << " rounds against calculateRound" << std::endl;
+
+    Stopwatch scalar;
+    Int scalarMax {runSimulation(seed, roundCount, calculateRound)};
+    double scalarSeconds {scalar.seconds()};
+
+    RoundVerifier verifier {options};
+    Stopwatch swar;
+    Int swarMax {runRoundSwar(seed, roundCount, verifier.ifEnabled())};
+    double swarSeconds {swar.seconds()};
+
+    Stopwatch lanes;
+    Int lanesMax {runRoundLanes(seed, roundCount, verifier.ifEnabled())};
+    double lanesSeconds {lanes.seconds()};
+    verifier.finish();
+
+    std::cerr << "Scalar: " << static_cast<std::uint64_t>(roundCount / scalarSeconds)
+        << " rounds/s, two rounds per register: "
+        << static_cast<std::uint64_t>(roundCount / swarSeconds)
+        << " rounds/s, " << laneCount << " lanes: "
+        << static_cast<std::uint64_t>(roundCount / lanesSeconds) << " rounds/s" << std::endl;
+    std::cerr << "Found at max " << swarMax << " hits" << std::endl;
+
+    if(swarMax != scalarMax || lanesMax != scalarMax) {
+        std::cerr << "The engines disagree" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * An example kernel plugin: the two-rounds-per-register engine of swar.hpp
+ * behind the kernel ABI. Build it with 'make plugin' and run it with
+ * './a.out plugin library=./swar_kernel.so'.
+ */
+#include "kernel_abi.h"
+#include "swar.hpp"
+
+namespace {
+
+int evaluateSwar(void*, const std::uint32_t* u, const std::uint32_t* v,
+        std::uint32_t* counts, std::uint64_t count) {
+    std::uint64_t i {0};
+    for(; i + 2 <= count; i += 2) {
+        SwarCounts pair {calculateRoundSwar(packSwar(State {.u = u[i], .v = v[i]},
+                State {.u = u[i + 1], .v = v[i + 1]}))};
+        counts[i] = pair.first;
+        counts[i + 1] = pair.second;
+    }
+    if(i < count)
+        counts[i] = calculateRound(State {.u = u[i], .v = v[i]});
+    return 0;
+}
+
+constexpr RandomParallelKernel swarKernel {
+    .abiVersion = RANDOM_PARALLEL_KERNEL_ABI,
+    .structSize = sizeof(RandomParallelKernel),
+    .capabilities = RANDOM_PARALLEL_THREAD_SAFE | RANDOM_PARALLEL_EXACT,
+    .name = "swar",
+    .blockSize = 4096,
+    .evaluate = evaluateSwar,
+    .context = nullptr,
+};
+
+}
+
+extern "C" const RandomParallelKernel* random_parallel_kernel() {
+    return &swarKernel;
+}
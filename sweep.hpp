@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+
+static inline constexpr Int defaultSweepAttempts {300};
+
+/*
+ * Per attempt count a from 1 to the largest one, the maximum number of hits
+ * among the first a attempts of any round and optionally how many rounds had
+ * how many hits among them.
+ */
+struct SweepResult {
+    Int maxAttempts;
+    std::vector<Int> maxima;
+    // (maxAttempts + 1) counters per attempt count, empty if not requested.
+    std::vector<std::uint64_t> histogram;
+
+    SweepResult(Int attemptCount, bool withHistogram)
+        : maxAttempts{attemptCount}, maxima(attemptCount + 1),
+          histogram(withHistogram ? (attemptCount + 1) * (attemptCount + 1) : 0) {}
+
+    void merge(const SweepResult& other) noexcept {
+        for(std::size_t i {0}; i < maxima.size(); ++i)
+            maxima[i] = std::max(maxima[i], other.maxima[i]);
+        for(std::size_t i {0}; i < histogram.size(); ++i)
+            histogram[i] += other.histogram[i];
+    }
+};
+
+/*
+ * Walks through the attempts of every round once and keeps the running hit
+ * count after each attempt, so all attempt counts share the generator work.
+ * The attempts of an output are taken from its lowest pair upwards, which is
+ * the order in which calculateRound masks the last output, so the entry for
+ * 'attempts' equals runSimulation.
+ */
+[[nodiscard]] inline SweepResult runSweepSimulation(State state,
+        std::uint64_t roundCount, Int maxAttempts, bool withHistogram) {
+    SweepResult result {maxAttempts, withHistogram};
+    Int words {(maxAttempts + numberOfExtractedPairs - 1) / numberOfExtractedPairs};
+
+    forEachWorker(state, roundCount,
+            [&](State& generator, std::uint64_t begin, std::uint64_t end) {
+        SweepResult local {maxAttempts, withHistogram};
+        std::vector<Int> prefix(words * numberOfExtractedPairs + 1);
+
+        for(std::uint64_t i {begin}; i < end; ++i) {
+            State round {deriveNewState(generator)};
+            Int count {0};
+            for(Int w {0}; w < words; ++w) {
+                Int n {nextRandomNumber(round)};
+                Int pairs {n & (n << 1) & alternatingBitmask};
+                for(Int k {0}; k < numberOfExtractedPairs; ++k) {
+                    count += (pairs >> (2 * k + 1)) & 1;
+                    prefix[w * numberOfExtractedPairs + k + 1] = count;
+                }
+            }
+
+            for(Int a {1}; a <= maxAttempts; ++a)
+                local.maxima[a] = std::max(local.maxima[a], prefix[a]);
+            if(withHistogram)
+                for(Int a {1}; a <= maxAttempts; ++a)
+                    ++local.histogram[a * (maxAttempts + 1) + prefix[a]];
+        }
+
+        # pragma omp critical
+        result.merge(local);
+    });
+
+    return result;
+}
+
+/*
+ * Prints the maximum for every attempt count from 1 to 'max-attempts' to
+ * stdout and optionally writes the histograms as CSV to 'histogram='.
+ */
+inline int runSweepMode(const Options& options, State seed) {
+    std::uint64_t roundCount {options.getUnsigned("rounds", rounds)};
+    Int maxAttempts {static_cast<Int>
+        (options.getUnsigned("max-attempts", defaultSweepAttempts))};
+    std::string histogramPath {options.getString("histogram", "")};
+    if(maxAttempts == 0 || maxAttempts > 4096)
+        throw std::invalid_argument {"max-attempts must be within 1 and 4096"};
+
+    std::cerr << "Sweeping attempt counts 1 to " << maxAttempts << " over "
+        << roundCount << " rounds" << std::endl;
+    Stopwatch stopwatch;
+    SweepResult result {runSweepSimulation(seed, roundCount, maxAttempts,
+            !histogramPath.empty())};
+    std::cerr << "Done in " << stopwatch.seconds() << " s" << std::endl;
+
+    std::cout << "attempts,max" << '\n';
+    for(Int a {1}; a <= maxAttempts; ++a)
+        std::cout << a << ',' << result.maxima[a] << '\n';
+    std::cout << std::flush;
+
+    if(!histogramPath.empty()) {
+        std::ofstream out {histogramPath};
+        out << "attempts,hits,rounds" << '\n';
+        for(Int a {1}; a <= maxAttempts; ++a)
+            for(Int h {0}; h <= a; ++h)
+                if(std::uint64_t n {result.histogram[a * (maxAttempts + 1) + h]}; n != 0)
+                    out << a << ',' << h << ',' << n << '\n';
+        if(!out)
+            throw std::runtime_error {"Could not write " + histogramPath};
+    }
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+#include "options.hpp"
+#include "rng.hpp"
+
+static inline constexpr double defaultVerifyRate {0.001};
+
+/*
+ * Recomputes a sample of the rounds an engine scored with calculateRound and
+ * remembers the first round they disagree on. A round is sampled if a hash of
+ * its state falls below 'rate' times 2^32, so the same rounds are checked
+ * however the run is split among threads, and choosing costs a multiply per
+ * round. Engines stop early once failed() is set; the caller then calls
+ * throwIfFailed().
+ */
+class RoundVerifier {
+    std::uint64_t threshold;
+    std::atomic<std::uint64_t> checkedRounds {0};
+    std::atomic<bool> mismatch {false};
+    std::mutex mutex;
+    State round {};
+    Int engineCount {0};
+    Int referenceCount {0};
+
+public:
+    // The verifier of 'verify=', off unless given.
+    explicit RoundVerifier(const Options& options)
+        : RoundVerifier{options.getDouble("verify", 0)} {}
+
+    explicit RoundVerifier(double rate)
+        : threshold{static_cast<std::uint64_t>(std::clamp(rate, 0.0, 1.0) * 4294967296.0)} {}
+
+    RoundVerifier(const RoundVerifier&) = delete;
+    RoundVerifier& operator=(const RoundVerifier&) = delete;
+
+    [[nodiscard]] bool enabled() const noexcept {
+        return threshold != 0;
+    }
+
+    [[nodiscard]] bool sampled(State state) const noexcept {
+        return (state.u ^ (state.v * 0x9e3779b1u)) < threshold;
+    }
+
+    // Checks 'count', the engine's result for the round 'state'.
+    void check(State state, Int count) {
+        checkedRounds.fetch_add(1, std::memory_order_relaxed);
+        Int expected {calculateRound(state)};
+        if(count == expected)
+            return;
+        std::lock_guard lock {mutex};
+        if(mismatch.exchange(true))
+            return;
+        round = state;
+        engineCount = count;
+        referenceCount = expected;
+    }
+
+    // Itself if it is on, for the engines' optional verifier.
+    [[nodiscard]] RoundVerifier* ifEnabled() noexcept {
+        return enabled() ? this : nullptr;
+    }
+
+    // Checks 'count' if the round 'state' is sampled.
+    void verify(State state, Int count) {
+        if(sampled(state))
+            check(state, count);
+    }
+
+    [[nodiscard]] bool failed() const noexcept {
+        return mismatch.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] std::uint64_t checked() const noexcept {
+        return checkedRounds.load(std::memory_order_relaxed);
+    }
+
+    /*
+     * Throws if a round disagreed, and otherwise says how many were checked.
+     * Nothing happens if the verifier is off.
+     */
+    void finish() {
+        if(!enabled())
+            return;
+        throwIfFailed();
+        std::cerr << "Verified " << checked() << " rounds against calculateRound" << std::endl;
+    }
+
+    void throwIfFailed() {
+        if(!failed())
+            return;
+        std::lock_guard lock {mutex};
+        throw std::runtime_error {"Verification failed for the round u=" + std::to_string(round.u)
+            + " v=" + std::to_string(round.v) + ": the engine counted "
+            + std::to_string(engineCount) + " hits, calculateRound "
+            + std::to_string(referenceCount)};
+    }
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "counters.hpp"
+#include "lanes.hpp"
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+#include "swar.hpp"
+#include "verifier.hpp"
+
+static inline constexpr std::uint64_t defaultVerifyRounds {100'000'000};
+static inline constexpr std::uint64_t defaultVerifyRepetitions {3};
+
+/*
+ * What online verification costs: runs 'engine=' (lanes, swar or counted, the
+ * counted runSimulation of the default mode) on 'rounds=' rounds without and
+ * with checking 'verify=' of them (default 0.001), 'repeat=' times each in
+ * turns, and compares the fastest runs.
+ */
+inline int runVerifyMode(const Options& options, State seed) {
+    std::uint64_t roundCount {options.getUnsigned("rounds", defaultVerifyRounds)};
+    std::uint64_t repeat {std::max<std::uint64_t>(
+            options.getUnsigned("repeat", defaultVerifyRepetitions), 1)};
+    double rate {options.getDouble("verify", defaultVerifyRate)};
+    std::string engine {options.getString("engine", "lanes")};
+    if(engine != "lanes" && engine != "swar" && engine != "counted")
+        throw std::invalid_argument {"engine must be lanes, swar or counted"};
+
+    auto run = [&](RoundVerifier* verifier) {
+        if(engine == "lanes")
+            return runRoundLanes(seed, roundCount, verifier);
+        if(engine == "swar")
+            return runRoundSwar(seed, roundCount, verifier);
+        RunCounters counters;
+        return runCountedSimulation(seed, roundCount, calculateRound, counters,
+                defaultTopRounds, verifier).maxCount;
+    };
+
+    double plainSeconds {0};
+    double verifiedSeconds {0};
+    Int plainMax {0};
+    Int verifiedMax {0};
+    std::uint64_t checked {0};
+    for(std::uint64_t r {0}; r < repeat; ++r) {
+        Stopwatch plain;
+        plainMax = run(nullptr);
+        double seconds {plain.seconds()};
+        plainSeconds = r == 0 ? seconds : std::min(plainSeconds, seconds);
+
+        RoundVerifier verifier {rate};
+        Stopwatch verified;
+        verifiedMax = run(verifier.ifEnabled());
+        seconds = verified.seconds();
+        verifiedSeconds = r == 0 ? seconds : std::min(verifiedSeconds, seconds);
+        verifier.throwIfFailed();
+        checked = verifier.checked();
+    }
+
+    std::cerr << engine << ": " << static_cast<std::uint64_t>(roundCount / plainSeconds)
+        << " rounds/s, verifying " << checked << " rounds ("
+        << 100.0 * static_cast<double>(checked) / static_cast<double>(roundCount) << "%): "
+        << static_cast<std::uint64_t>(roundCount / verifiedSeconds) << " rounds/s, "
+        << 100 * (verifiedSeconds / plainSeconds - 1) << "% slower" << std::endl;
+    std::cerr << "Found at max " << verifiedMax << " hits" << std::endl;
+    return plainMax == verifiedMax ? 0 : 1;
+}
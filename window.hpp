@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+
+#include "jump.hpp"
+#include "options.hpp"
+#include "rng.hpp"
+#include "simulation.hpp"
+
+static inline constexpr std::uint64_t defaultStreamAttempts {100'000'000'000};
+static inline constexpr std::uint64_t windowChunkOutputs {1 << 24};
+
+/*
+ * The hit pairs of an output squeezed into 16 bits, lowest attempt first.
+ */
+[[nodiscard]] inline constexpr Int compressPairHits(Int n) noexcept {
+    Int x {n & (n >> 1) & 0x55555555};
+    x = (x | (x >> 1)) & 0x33333333;
+    x = (x | (x >> 2)) & 0x0f0f0f0f;
+    x = (x | (x >> 4)) & 0x00ff00ff;
+    return (x | (x >> 8)) & 0xffff;
+}
+
+/*
+ * Sliding a window by eight attempts adds eight hit bits at its end and drops
+ * eight at its start. For every pair of such bytes this table holds the total
+ * change of the window count and the highest change after any of the eight
+ * steps, so a window moves by eight attempts with a single lookup.
+ */
+struct WindowStep {
+    std::int8_t total;
+    std::int8_t best;
+};
+
+using WindowStepTable = std::array<WindowStep, 1 << 16>;
+
+[[nodiscard]] inline WindowStepTable makeWindowStepTable() noexcept {
+    WindowStepTable table;
+    for(Int added = 0; added < 256; ++added) {
+        for(Int dropped = 0; dropped < 256; ++dropped) {
+            int total {0};
+            int best {-8};
+            for(Int k = 0; k < 8; ++k) {
+                total += static_cast<int>((added >> k) & 1)
+                    - static_cast<int>((dropped >> k) & 1);
+                best = std::max(best, total);
+            }
+            table[added << 8 | dropped] = WindowStep
+                {.total = static_cast<std::int8_t>(total),
+                 .best = static_cast<std::int8_t>(best)};
+        }
+    }
+
+    return table;
+}
+
+/*
+ * Slides a window of 'attempts' attempts over the compressed hits of
+ * consecutive outputs. The hits of the last 16 outputs are kept in a ring to
+ * find the ones that leave the window.
+ */
+class SlidingWindow {
+    static inline constexpr Int history {16};
+
+    // Attempts leaving the window start this many outputs back, at this pair.
+    static inline constexpr Int lagOutputs {(attempts + numberOfExtractedPairs - 1)
+        / numberOfExtractedPairs};
+    static inline constexpr Int lagPair {lagOutputs * numberOfExtractedPairs - attempts};
+    static_assert(lagOutputs < history, "The window does not fit into the history");
+
+    const WindowStepTable& steps;
+    std::array<Int, history> ring {};
+    std::uint64_t position {0};
+    int count {0};
+
+public:
+    explicit SlidingWindow(const WindowStepTable& table) noexcept: steps{table} {}
+
+    /*
+     * Adds the 16 attempts of one output and returns the highest count of the
+     * windows ending at any of them.
+     */
+    int push(Int hits) noexcept {
+        Int older {ring[(position - lagOutputs) % history]};
+        Int newer {ring[(position - lagOutputs + 1) % history]};
+        Int dropped {((newer << numberOfExtractedPairs | older) >> lagPair) & 0xffff};
+        ring[position % history] = hits;
+        ++position;
+
+        WindowStep low {steps[(hits & 0xff) << 8 | (dropped & 0xff)]};
+        WindowStep high {steps[(hits >> 8) << 8 | (dropped >> 8)]};
+        int best {std::max(count + low.best, count + low.total + high.best)};
+        count += low.total + high.total;
+        return best;
+    }
+};
+
+/*
+ * Treats the outputs of one generator as an unbroken stream of 2-bit attempts
+ * and returns the highest number of hits in any 'attempts' consecutive ones
+ * among the first 'outputs' * 16. The stream is cut into chunks that start
+ * with jumpAhead; a chunk first replays the outputs of the window reaching
+ * into it and then counts the windows ending inside it.
+ */
+[[nodiscard]] inline Int runSlidingWindow(State state, std::uint64_t outputs) {
+    static const WindowStepTable steps {makeWindowStepTable()};
+    std::uint64_t chunks {(outputs + windowChunkOutputs - 1) / windowChunkOutputs};
+    int maxCount {0};
+
+    # pragma omp parallel for schedule(dynamic) reduction(max:maxCount)
+    for(std::uint64_t chunk = 0; chunk < chunks; ++chunk) {
+        std::uint64_t begin {chunk * windowChunkOutputs};
+        std::uint64_t end {std::min(outputs, begin + windowChunkOutputs)};
+        std::uint64_t warmup {std::min<std::uint64_t>(begin, 16)};
+        State generator {jumpAhead(state, begin - warmup)};
+        SlidingWindow window {steps};
+
+        for(std::uint64_t i {0}; i < warmup; ++i)
+            static_cast<void>(window.push(compressPairHits(nextRandomNumber(generator))));
+        for(std::uint64_t i {begin}; i < end; ++i)
+            maxCount = std::max(maxCount,
+                    window.push(compressPairHits(nextRandomNumber(generator))));
+    }
+
+    return static_cast<Int>(maxCount);
+}
+
+/*
+ * One attempt at a time, for checking runSlidingWindow. The window's hits are
+ * kept in a ring of 'attempts' entries, the oldest one at 'next'.
+ */
+[[nodiscard]] inline Int runSlidingWindowReference(State state,
+        std::uint64_t outputs) {
+    std::array<bool, attempts> hits {};
+    std::size_t next {0};
+    Int count {0};
+    Int maxCount {0};
+    for(std::uint64_t i {0}; i < outputs; ++i) {
+        Int n {nextRandomNumber(state)};
+        for(Int k {0}; k < numberOfExtractedPairs; ++k) {
+            bool hit {((n >> (2 * k)) & 3) == 3};
+            count += hit;
+            count -= hits[next];
+            hits[next] = hit;
+            next = next + 1 == hits.size() ? 0 : next + 1;
+            maxCount = std::max(maxCount, count);
+        }
+    }
+
+    return maxCount;
+}
+
+/*
+ * The highest number of hits in any window of 'attempts' consecutive attempts
+ * among the first 'stream=' attempts (rounded down to whole outputs) of the
+ * generator seeded with the seed itself.
+ */
+inline int runWindowMode(const Options& options, State seed) {
+    std::uint64_t streamAttempts {options.getUnsigned("stream", defaultStreamAttempts)};
+    std::uint64_t outputs {streamAttempts / numberOfExtractedPairs};
+    if(outputs * numberOfExtractedPairs < attempts)
+        throw std::invalid_argument {"The stream is shorter than a window"};
+
+    std::cerr << "Sliding a window of " << attempts << " attempts over "
+        << outputs * numberOfExtractedPairs << " attempts" << std::endl;
+    Stopwatch stopwatch;
+    Int maxHits {runSlidingWindow(seed, outputs)};
+    double seconds {stopwatch.seconds()};
+    std::cerr << "Found at max " << maxHits << " hits in " << seconds << " s ("
+        << static_cast<std::uint64_t>(outputs / seconds) << " outputs/s)"
+        << std::endl;
+
+    if(options.getUnsigned("check", 0) != 0) {
+        Int expected {runSlidingWindowReference(seed, outputs)};
+        if(expected != maxHits) {
+            std::cerr << "The reference found " << expected << " hits" << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
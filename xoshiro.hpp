@@ -0,0 +1,60 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+
+/*
+ * xoshiro256** by Blackman and Vigna, a fast general purpose 64-bit generator
+ * used where the engines need ideal uniform numbers rather than the challenge
+ * generator.
+ */
+class Xoshiro256 {
+    std::uint64_t s[4];
+
+    [[nodiscard]] static constexpr std::uint64_t splitMix(std::uint64_t& x) noexcept {
+        std::uint64_t z {x += 0x9e3779b97f4a7c15};
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+
+public:
+    explicit constexpr Xoshiro256(std::uint64_t seed) noexcept
+        : s{splitMix(seed), splitMix(seed), splitMix(seed), splitMix(seed)} {}
+
+    constexpr std::uint64_t operator()() noexcept {
+        std::uint64_t result {std::rotl(s[1] * 5, 7) * 9};
+        std::uint64_t t {s[1] << 17};
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = std::rotl(s[3], 45);
+        return result;
+    }
+
+    /*
+     * Advances by 2^128 outputs, giving non-overlapping streams per thread.
+     */
+    constexpr void jump() noexcept {
+        constexpr std::uint64_t polynomial[] {0x180ec6d33cfd0aba, 0xd5a61266f0c9392c,
+            0xa9582618e03fc9aa, 0x39abdc4529b1661c};
+        std::uint64_t t[4] {};
+        for(std::uint64_t word : polynomial) {
+            for(int b {0}; b < 64; ++b) {
+                if(word & (std::uint64_t{1} << b))
+                    for(int i {0}; i < 4; ++i)
+                        t[i] ^= s[i];
+                static_cast<void>((*this)());
+            }
+        }
+        for(int i {0}; i < 4; ++i)
+            s[i] = t[i];
+    }
+
+    // A uniform double in [0, 1).
+    constexpr double uniform() noexcept {
+        return static_cast<double>((*this)() >> 11) * 0x1.0p-53;
+    }
+};